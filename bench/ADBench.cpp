@@ -0,0 +1,208 @@
+// Operator microbenchmark: every AD operator (AD op AD, AD op Number,
+// Number op AD and unary minus) across design space sizes and storage
+// modes
+//
+//    fixed     AD<N>, N = 1 .. 32 (inline storage)
+//    dynamic   AD<>, heap storage
+//    arena     AD<>, storage from an ADArena
+//    hybrid    ADHybrid, operands seeded as independent variables
+//
+// Each (mode, n, op) is warmed up, then timed in `samples` samples of
+// an inner loop calibrated to about 1 ms; the median and the 10th and
+// 90th percentiles are reported in ns per operation.  The AD operands
+// have dense gradients and Hessians (except hybrid, which is timed on
+// the sparse seeds it is meant for).
+//
+// usage> ./run/ADBench [--json] [--max-n N] [--samples S]
+//
+// --json prints one JSON document to stdout instead of the table.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../include/AutomaticDifferentiation.h"
+#include "../include/ADHybrid.h"
+
+
+struct Result {
+   std::string mode;
+   int n;
+   std::string op;
+   double median, p10, p90, min;
+   long inner;
+};
+
+struct Options {
+   bool json = false;
+   int max_n = 2048;
+   int samples = 15;
+};
+
+// keeps the optimizer from dropping the timed work
+volatile Number sink;
+
+
+// value of the q-quantile of sorted data
+double quantile(const std::vector<double>& sorted, double q) {
+   const double position = q*(sorted.size() - 1);
+   const std::size_t lo = std::size_t(position);
+   const std::size_t hi = std::min(lo + 1, sorted.size() - 1);
+   return sorted[lo] + (position - lo)*(sorted[hi] - sorted[lo]);
+}
+
+// time op() per call: warmup, calibrate the inner loop, then sample
+template <typename Op>
+Result measure(const Options& options, Op op) {
+
+   typedef std::chrono::steady_clock Clock;
+   auto run = [&](long inner) {
+      auto t0 = Clock::now();
+      for (long r = 0; r < inner; ++r) op();
+      return std::chrono::duration<double>(Clock::now() - t0).count();
+   };
+
+   // warmup and calibration: grow the inner loop to about 1 ms
+   long inner = 1;
+   while (run(inner) < 1.e-3 && inner < (1L << 24)) inner *= 2;
+
+   std::vector<double> ns(options.samples);
+   for (double& t : ns) t = run(inner)/inner*1.e9;
+   std::sort(ns.begin(), ns.end());
+
+   Result result;
+   result.median = quantile(ns, 0.5);
+   result.p10 = quantile(ns, 0.1);
+   result.p90 = quantile(ns, 0.9);
+   result.min = ns.front();
+   result.inner = inner;
+   return result;
+}
+
+
+// fill gradient and Hessian with dense nonzero data
+template <typename T>
+void densify(T& x, int n, Number seed) {
+   for (int i = 0; i < n; ++i) x.grad(i) = seed + Number(i % 7)/Number(7);
+   for (int k = 0; k < x.hess.data.size(); ++k) x.hess.data(k) = seed*Number(0.5) + Number(k % 5)/Number(5);
+}
+
+// every operator on the operands a, b of type T; Make turns an
+// expression into a stored T, Scope is entered around each operation
+template <typename T, typename Make, typename Scope>
+void operators(const Options& options, const std::string& mode, int n,
+               T& a, T& b, Make make, Scope scope, std::vector<Result>& results) {
+
+   const Number c = Number(1.25);
+
+   auto add = [&](const char* name, auto op) {
+      Result r = measure(options, [&]() { scope([&]() { sink = make(op()).value; }); });
+      r.mode = mode;
+      r.n = n;
+      r.op = name;
+      results.push_back(r);
+      if (!options.json) {
+         std::cout << "  " << mode << "  n = " << n << "  " << name
+                   << "  median " << r.median << " ns  (p10 " << r.p10
+                   << ", p90 " << r.p90 << ")" << std::endl;
+      }
+   };
+
+   add("add", [&]() { return a + b; });
+   add("sub", [&]() { return a - b; });
+   add("mul", [&]() { return a * b; });
+   add("div", [&]() { return a / b; });
+   add("add_number", [&]() { return a + c; });
+   add("sub_number", [&]() { return a - c; });
+   add("mul_number", [&]() { return a * c; });
+   add("div_number", [&]() { return a / c; });
+   add("number_add", [&]() { return c + a; });
+   add("number_sub", [&]() { return c - a; });
+   add("number_mul", [&]() { return c * a; });
+   add("number_div", [&]() { return c / a; });
+   add("neg", [&]() { return -a; });
+}
+
+
+template <int N>
+void fixed(const Options& options, std::vector<Result>& results) {
+   if (N > options.max_n) return;
+   AD<N> a(Number(1.5), N, 0), b(Number(2.5), N, N - 1);
+   densify(a, N, Number(1));
+   densify(b, N, Number(2));
+   operators(options, "fixed", N, a, b,
+             [](const auto& e) { return AD<N>(e); },
+             [](auto f) { f(); }, results);
+}
+
+void dynamic(const Options& options, int n, std::vector<Result>& results) {
+   AD<> a(Number(1.5), n, 0), b(Number(2.5), n, n - 1);
+   densify(a, n, Number(1));
+   densify(b, n, Number(2));
+   operators(options, "dynamic", n, a, b,
+             [](const auto& e) { return AD<>(e); },
+             [](auto f) { f(); }, results);
+
+   ADArena arena;
+   operators(options, "arena", n, a, b,
+             [](const auto& e) { return AD<>(e); },
+             [&](auto f) { ADArenaScope scope(arena); f(); }, results);
+}
+
+void hybrid(const Options& options, int n, std::vector<Result>& results) {
+   ADHybrid<> a(Number(1.5), n, 0), b(Number(2.5), n, n - 1);
+   operators(options, "hybrid", n, a, b,
+             [](const ADHybrid<>& e) { return e; },
+             [](auto f) { f(); }, results);
+}
+
+
+void print_json(const Options& options, const std::vector<Result>& results) {
+   std::cout << "{\n  \"benchmark\": \"ADBench\",\n  \"unit\": \"ns\",\n"
+             << "  \"samples\": " << options.samples << ",\n  \"results\": [\n";
+   for (std::size_t i = 0; i < results.size(); ++i) {
+      const Result& r = results[i];
+      std::cout << "    {\"mode\": \"" << r.mode << "\", \"n\": " << r.n
+                << ", \"op\": \"" << r.op << "\", \"median\": " << r.median
+                << ", \"p10\": " << r.p10 << ", \"p90\": " << r.p90
+                << ", \"min\": " << r.min << ", \"inner\": " << r.inner << "}"
+                << (i + 1 < results.size() ? ",\n" : "\n");
+   }
+   std::cout << "  ]\n}" << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+
+   Options options;
+   for (int i = 1; i < argc; ++i) {
+      if (!std::strcmp(argv[i], "--json")) options.json = true;
+      else if (!std::strcmp(argv[i], "--max-n") && i + 1 < argc) options.max_n = std::atoi(argv[++i]);
+      else if (!std::strcmp(argv[i], "--samples") && i + 1 < argc) options.samples = std::max(1, std::atoi(argv[++i]));
+      else {
+         std::cerr << "usage: " << argv[0] << " [--json] [--max-n N] [--samples S]" << std::endl;
+         return 1;
+      }
+   }
+
+   std::vector<Result> results;
+
+   fixed<1>(options, results);
+   fixed<2>(options, results);
+   fixed<4>(options, results);
+   fixed<8>(options, results);
+   fixed<16>(options, results);
+   fixed<32>(options, results);
+
+   for (int n = 1; n <= options.max_n; n *= 2) {
+      dynamic(options, n, results);
+      hybrid(options, n, results);
+   }
+
+   if (options.json) print_json(options, results);
+
+   return 0;
+}
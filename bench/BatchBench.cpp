@@ -0,0 +1,102 @@
+// Point sweep benchmark: the same objective evaluated (value, gradient
+// and Hessian) at many design points, one AD<N> per point versus
+// ADBatch<W, N> carrying W points per evaluation.
+//
+// usage> ./run/BatchBench [points]
+
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+
+#include "../include/ADBatch.h"
+
+
+// generalized Rosenbrock plus a quotient term, written once for any
+// AD flavour
+template <typename T>
+T objective(const std::vector<T>& x) {
+   T f = (1.0f - x[0])*(1.0f - x[0]);
+   for (std::size_t i = 0; i + 1 < x.size(); ++i) {
+      T t = x[i+1] - x[i]*x[i];
+      T s = 1.0f - x[i];
+      f = f + 100.0f*t*t + s*s;
+   }
+   f = f + x[0]/(1.0f + x[1]*x[1]);
+   return f;
+}
+
+// design point p, coordinate i
+inline Number coordinate(int p, int i) {
+   return Number(0.5) + Number((p*7 + i*13) % 101)/Number(101);
+}
+
+template <typename F>
+double best_seconds(F f, int repetitions) {
+   double best = 1.e30;
+   for (int r = 0; r < repetitions; ++r) {
+      auto t0 = std::chrono::steady_clock::now();
+      f();
+      auto t1 = std::chrono::steady_clock::now();
+      best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+   }
+   return best;
+}
+
+
+template <int W, int N>
+void sweep(int points) {
+
+   const int repetitions = 5;
+   Number scalar_sum = 0, batch_sum = 0;
+
+   double scalar = best_seconds([&]() {
+      scalar_sum = 0;
+      std::vector< AD<N> > x;
+      x.reserve(N);
+      for (int p = 0; p < points; ++p) {
+         x.clear();
+         for (int i = 0; i < N; ++i) x.emplace_back(coordinate(p, i), N, i);
+         AD<N> f = objective(x);
+         scalar_sum += f.value + f.grad.sum() + f.hess.data.sum();
+      }
+   }, repetitions);
+
+   double batch = best_seconds([&]() {
+      batch_sum = 0;
+      std::vector< ADBatch<W, N> > x;
+      x.reserve(N);
+      typename ADBatch<W, N>::Lanes lanes;
+      for (int p = 0; p < points; p += W) {
+         x.clear();
+         for (int i = 0; i < N; ++i) {
+            for (int w = 0; w < W; ++w) lanes(w) = coordinate(p + w, i);
+            x.emplace_back(lanes, N, i);
+         }
+         ADBatch<W, N> f = objective(x);
+         batch_sum += f.value.sum() + f.grad.sum() + f.hess.sum();
+      }
+   }, repetitions);
+
+   std::cout << "  n = " << N << "  W = " << W
+             << "  scalar: " << points/scalar << " points/s"
+             << "  batched: " << points/batch << " points/s"
+             << "  speedup: " << scalar/batch
+             << "  (checksum diff " << std::abs(scalar_sum - batch_sum)/std::abs(scalar_sum) << ")"
+             << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+
+   int points = (argc > 1) ? std::atoi(argv[1]) : (1 << 16);
+   points -= points % 16;
+
+   std::cout << "point sweep, " << points << " points, value + gradient + Hessian" << std::endl;
+
+   sweep<8, 2>(points);
+   sweep<8, 4>(points);
+   sweep<8, 8>(points);
+   sweep<16, 4>(points);
+
+   return 0;
+}
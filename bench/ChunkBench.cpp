@@ -0,0 +1,80 @@
+// Chunk size benchmark: the gradient of one function of n inputs by
+// chunked_gradient with K seed directions per pass, against a single
+// pass carrying all n directions.  The fastest K depends on the cache
+// sizes of the machine.  The last line is one reverse sweep over an
+// ADTape, whose cost does not grow with n per operation.
+//
+// usage> ./run/ChunkBench [n]
+
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+
+#include "../include/ADChunk.h"
+#include "../include/ADReverse.h"
+
+
+// a chained least squares type objective with a few transcendental
+// terms, written once for any AD flavour
+template <typename T>
+T objective(const std::vector<T>& x) {
+   T f = x[0]*x[0];
+   for (std::size_t i = 1; i < x.size(); ++i) {
+      T t = x[i] - x[i-1]*x[i-1];
+      f += 100.0f*t*t + sin(x[i])*x[i-1];
+   }
+   return f;
+}
+
+template <typename F>
+double best_seconds(F f, int repetitions) {
+   double best = 1.e30;
+   for (int r = 0; r < repetitions; ++r) {
+      auto t0 = std::chrono::steady_clock::now();
+      f();
+      auto t1 = std::chrono::steady_clock::now();
+      best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+   }
+   return best;
+}
+
+template <int K>
+void chunk(const Eigen::VectorXf& x, const Eigen::VectorXf& reference, double full) {
+   Eigen::VectorXf g;
+   auto f = [](const auto& v) { return objective(v); };
+   double seconds = best_seconds([&]() { g = chunked_gradient<K>(f, x); }, 3);
+   std::cout << "  K = " << K << ": " << seconds << " s"
+             << "  speedup vs full pass: " << full/seconds
+             << "  (diff " << (g - reference).norm()/reference.norm() << ")" << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+
+   const int n = (argc > 1) ? std::atoi(argv[1]) : 2000;
+
+   Eigen::VectorXf x(n);
+   for (int i = 0; i < n; ++i) x(i) = Number(0.5) + Number((i*13) % 101)/Number(101);
+
+   std::cout << "gradient of a chained objective, n = " << n << std::endl;
+
+   Eigen::VectorXf reference;
+   auto f = [](const auto& v) { return objective(v); };
+   double full = best_seconds([&]() { reference = chunked_gradient<Dynamic>(f, x, n); }, 3);
+   std::cout << "  full pass (K = n): " << full << " s" << std::endl;
+
+   chunk<4>(x, reference, full);
+   chunk<8>(x, reference, full);
+   chunk<16>(x, reference, full);
+   chunk<32>(x, reference, full);
+   chunk<64>(x, reference, full);
+
+   Eigen::VectorXf g;
+   ADTape<> tape;
+   double reverse = best_seconds([&]() { g = reverse_gradient(f, x, tape); }, 3);
+   std::cout << "  reverse sweep: " << reverse << " s"
+             << "  speedup vs full pass: " << full/reverse
+             << "  (diff " << (g - reference).norm()/reference.norm() << ")" << std::endl;
+
+   return 0;
+}
@@ -0,0 +1,173 @@
+// Eigen integration benchmark: dot products, matrix-vector products
+// and small dense solves with AD as the Eigen scalar type (ADEigen.h)
+// against the same operations unrolled by hand into scalar AD loops.
+// Every entry depends on P design parameters, so each scalar operation
+// carries a gradient and Hessian of size P.  The last line per size is
+// linear_solve (ADLinearSolve.h), which factors the values once,
+// against the AD LU solve.
+//
+// usage> ./run/EigenBench [repetitions]
+
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+
+#include "../include/ADLinearSolve.h"
+
+
+const int P = 4;
+typedef AD<P> T;
+typedef Eigen::Matrix<T, Dynamic, Dynamic> MatrixT;
+typedef Eigen::Matrix<T, Dynamic, 1> VectorT;
+
+template <typename F>
+double best_seconds(F f, int repetitions) {
+   double best = 1.e30;
+   for (int r = 0; r < repetitions; ++r) {
+      auto t0 = std::chrono::steady_clock::now();
+      f();
+      auto t1 = std::chrono::steady_clock::now();
+      best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+   }
+   return best;
+}
+
+// diagonally dominant test data, every entry a function of the
+// parameters p
+void fill(const std::vector<T>& p, MatrixT& A, VectorT& b) {
+   const int n = int(b.size());
+   for (int i = 0; i < n; ++i) {
+      b(i) = p[i % P]*Number(1 + i % 3) + Number(0.5);
+      for (int j = 0; j < n; ++j) {
+         A(i, j) = p[(i + j) % P]*Number(((i*7 + j*13) % 11) - 5)/Number(10*n);
+      }
+      A(i, i) += Number(2);
+   }
+}
+
+//-------------------------
+// hand unrolled versions
+
+T dot(const MatrixT& A, const VectorT& b) {
+   T s = A(0, 0)*b(0);
+   for (int i = 1; i < b.size(); ++i) s += A(0, i)*b(i);
+   return s;
+}
+
+std::vector<T> matvec(const MatrixT& A, const VectorT& b) {
+   const int n = int(b.size());
+   std::vector<T> y;
+   y.reserve(n);
+   for (int i = 0; i < n; ++i) {
+      T s = A(i, 0)*b(0);
+      for (int j = 1; j < n; ++j) s += A(i, j)*b(j);
+      y.push_back(s);
+   }
+   return y;
+}
+
+// Gaussian elimination with partial pivoting
+std::vector<T> solve(MatrixT A, VectorT b) {
+   const int n = int(b.size());
+   for (int k = 0; k < n; ++k) {
+      int pivot = k;
+      for (int i = k + 1; i < n; ++i) {
+         if (std::abs(A(i, k).value) > std::abs(A(pivot, k).value)) pivot = i;
+      }
+      A.row(k).swap(A.row(pivot));
+      std::swap(b(k), b(pivot));
+      for (int i = k + 1; i < n; ++i) {
+         const T l = A(i, k)/A(k, k);
+         for (int j = k + 1; j < n; ++j) A(i, j) -= l*A(k, j);
+         b(i) -= l*b(k);
+      }
+   }
+   std::vector<T> x(n);
+   for (int i = n - 1; i >= 0; --i) {
+      T s = b(i);
+      for (int j = i + 1; j < n; ++j) s -= A(i, j)*x[j];
+      x[i] = s/A(i, i);
+   }
+   return x;
+}
+
+
+void compare(int n, int repetitions) {
+
+   std::vector<T> p;
+   for (int k = 0; k < P; ++k) p.emplace_back(Number(0.5) + Number(k)/Number(P), P, k);
+
+   MatrixT A(n, n);
+   VectorT b(n);
+   fill(p, A, b);
+
+   Number eigen_sum = 0, hand_sum = 0;
+
+   auto report = [&](const char* what, double eigen, double hand) {
+      std::cout << "  n = " << n << "  " << what << ":  Eigen " << eigen*1.e6 << " us"
+                << "  by hand " << hand*1.e6 << " us"
+                << "  ratio " << eigen/hand
+                << "  (diff " << std::abs(eigen_sum - hand_sum) << ")" << std::endl;
+   };
+
+   double eigen = best_seconds([&]() {
+      T s = A.row(0).transpose().dot(b);
+      eigen_sum = s.grad.sum() + s.hess.data.sum();
+   }, repetitions);
+   double hand = best_seconds([&]() {
+      T s = dot(A, b);
+      hand_sum = s.grad.sum() + s.hess.data.sum();
+   }, repetitions);
+   report("dot   ", eigen, hand);
+
+   eigen = best_seconds([&]() {
+      VectorT y = A*b;
+      eigen_sum = 0;
+      for (int i = 0; i < n; ++i) eigen_sum += y(i).grad.sum() + y(i).hess.data.sum();
+   }, repetitions);
+   hand = best_seconds([&]() {
+      std::vector<T> y = matvec(A, b);
+      hand_sum = 0;
+      for (int i = 0; i < n; ++i) hand_sum += y[i].grad.sum() + y[i].hess.data.sum();
+   }, repetitions);
+   report("matvec", eigen, hand);
+
+   eigen = best_seconds([&]() {
+      VectorT x = A.partialPivLu().solve(b);
+      eigen_sum = 0;
+      for (int i = 0; i < n; ++i) eigen_sum += x(i).grad.sum() + x(i).hess.data.sum();
+   }, repetitions);
+   hand = best_seconds([&]() {
+      std::vector<T> x = solve(A, b);
+      hand_sum = 0;
+      for (int i = 0; i < n; ++i) hand_sum += x[i].grad.sum() + x[i].hess.data.sum();
+   }, repetitions);
+   report("solve ", eigen, hand);
+
+   hand = eigen;
+   hand_sum = eigen_sum;
+   double factored = best_seconds([&]() {
+      VectorT x = linear_solve(A, b);
+      eigen_sum = 0;
+      for (int i = 0; i < n; ++i) eigen_sum += x(i).grad.sum() + x(i).hess.data.sum();
+   }, repetitions);
+   std::cout << "  n = " << n << "  linear_solve: " << factored*1.e6 << " us"
+             << "  speedup vs AD LU: " << hand/factored
+             << "  (diff " << std::abs(eigen_sum - hand_sum) << ")" << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+
+   const int repetitions = (argc > 1) ? std::atoi(argv[1]) : 20;
+
+   std::cout << "Eigen::Matrix<AD<" << P << ">> versus hand unrolled AD loops" << std::endl;
+
+   compare(4, repetitions);
+   compare(8, repetitions);
+   compare(16, repetitions);
+   compare(32, repetitions);
+   compare(64, repetitions);
+
+   return 0;
+}
@@ -0,0 +1,265 @@
+// 1D Euler finite volume benchmark: the residual of a first order Roe
+// scheme on N cells (conservative variables rho, rho*u, rho*E per cell,
+// zero gradient boundaries) and its block tridiagonal flux Jacobian.
+//
+// The Jacobian is assembled face by face: each Roe flux is evaluated
+// once with ADGradient<6> over the 6 unknowns of its two cells and the
+// 3 x 6 local Jacobian is added into the CSR matrix, so the derivative
+// work per face is fixed however large N is.  Up to N = 10^4 it is
+// checked against sparse_jacobian (ADColoring.h) on the whole residual.
+//
+// The same face loop also runs through assemble_jacobian (ADAssembly.h),
+// with the faces as elements of 6 unknowns, on one and on all hardware
+// threads.
+//
+// usage> ./run/EulerBench [largest N] [repetitions]
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "../include/ADAssembly.h"
+
+
+const Number gamma_gas = Number(1.4);
+const double pi = 3.14159265358979323846;
+
+typedef ADGradient<6> T;
+typedef Eigen::SparseMatrix<Number, Eigen::RowMajor> Jacobian;
+
+template <typename F>
+double best_seconds(F f, int repetitions) {
+   double best = 1.e30;
+   for (int r = 0; r < repetitions; ++r) {
+      auto t0 = std::chrono::steady_clock::now();
+      f();
+      auto t1 = std::chrono::steady_clock::now();
+      best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+   }
+   return best;
+}
+
+//-------------------------
+// Roe flux between the conservative states left and right, appended
+// to flux (mass, momentum, energy).  |lambda|
+// is smoothed to sqrt(lambda^2 + (a/10)^2) (entropy fix), so the flux
+// is differentiable everywhere.
+template <typename S>
+void roe_flux(const S* left, const S* right, std::vector<S>& flux) {
+   using std::sqrt;
+
+   const S uL = left[1]/left[0];
+   const S uR = right[1]/right[0];
+   const S pL = (gamma_gas - 1)*(left[2] - Number(0.5)*left[1]*uL);
+   const S pR = (gamma_gas - 1)*(right[2] - Number(0.5)*right[1]*uR);
+   const S HL = (left[2] + pL)/left[0];
+   const S HR = (right[2] + pR)/right[0];
+
+   // Roe averages
+   const S sL = sqrt(left[0]);
+   const S sR = sqrt(right[0]);
+   const S rho = sL*sR;
+   const S u = (sL*uL + sR*uR)/(sL + sR);
+   const S H = (sL*HL + sR*HR)/(sL + sR);
+   const S a2 = (gamma_gas - 1)*(H - Number(0.5)*u*u);
+   const S a = sqrt(a2);
+
+   // wave strengths
+   const S dp = pR - pL;
+   const S du = uR - uL;
+   const S alpha1 = (dp - rho*a*du)/(Number(2)*a2);
+   const S alpha2 = (right[0] - left[0]) - dp/a2;
+   const S alpha3 = (dp + rho*a*du)/(Number(2)*a2);
+
+   // smoothed |eigenvalues| times strengths
+   const S eps2 = Number(0.01)*a2;
+   const S w1 = sqrt((u - a)*(u - a) + eps2)*alpha1;
+   const S w2 = sqrt(u*u + eps2)*alpha2;
+   const S w3 = sqrt((u + a)*(u + a) + eps2)*alpha3;
+
+   flux.push_back(Number(0.5)*(left[1] + right[1] - (w1 + w2 + w3)));
+   flux.push_back(Number(0.5)*(left[1]*uL + pL + right[1]*uR + pR
+                          - (w1*(u - a) + w2*u + w3*(u + a))));
+   flux.push_back(Number(0.5)*((left[2] + pL)*uL + (right[2] + pR)*uR
+                          - (w1*(H - u*a) + w2*Number(0.5)*u*u + w3*(H + u*a))));
+}
+
+// residual of cell i: F(i+1/2) - F(i-1/2), 3 entries per cell; face f
+// lies between cells f-1 and f
+template <typename S>
+std::vector<S> residual(const std::vector<S>& q) {
+   const int cells = int(q.size())/3;
+   std::vector<S> faces;
+   faces.reserve(3*(cells + 1));
+   for (int f = 0; f <= cells; ++f) {
+      const int left = std::max(f - 1, 0);
+      const int right = std::min(f, cells - 1);
+      roe_flux(&q[3*left], &q[3*right], faces);
+   }
+   std::vector<S> r;
+   r.reserve(q.size());
+   for (int k = 0; k < 3*cells; ++k) r.push_back(faces[k + 3] - faces[k]);
+   return r;
+}
+
+//-------------------------
+// block tridiagonal CSR structure with 3 x 3 blocks
+Jacobian block_tridiagonal(int cells) {
+   Jacobian J(3*cells, 3*cells);
+   J.resizeNonZeros(3*(3*3*cells - 2*3));
+   int* row_ptr = J.outerIndexPtr();
+   int* col_idx = J.innerIndexPtr();
+   int k = 0;
+   for (int i = 0; i < cells; ++i) {
+      const int first = std::max(i - 1, 0);
+      const int last = std::min(i + 1, cells - 1);
+      for (int a = 0; a < 3; ++a) {
+         row_ptr[3*i + a] = k;
+         for (int j = 3*first; j < 3*last + 3; ++j) col_idx[k++] = j;
+      }
+   }
+   row_ptr[3*cells] = k;
+   std::fill(J.valuePtr(), J.valuePtr() + k, Number(0));
+   return J;
+}
+
+// J += sign * d flux / d (left, right) in the rows of cell i
+void scatter(Jacobian& J, int i, int left, int right, const std::vector<T>& flux, Number sign) {
+   const int first = std::max(i - 1, 0);
+   Number* values = J.valuePtr();
+   for (int a = 0; a < 3; ++a) {
+      Number* row = values + J.outerIndexPtr()[3*i + a];
+      for (int b = 0; b < 3; ++b) {
+         row[3*(left - first) + b] += sign*flux[a].grad(b);
+         row[3*(right - first) + b] += sign*flux[a].grad(3 + b);
+      }
+   }
+}
+
+// flux Jacobian of the residual, one local ADGradient<6> flux per face
+void assemble(const Eigen::VectorXf& q, Jacobian& J) {
+   const int cells = int(q.size())/3;
+   std::fill(J.valuePtr(), J.valuePtr() + J.nonZeros(), Number(0));
+   T left[3], right[3];
+   std::vector<T> flux;
+   flux.reserve(3);
+   for (int f = 0; f <= cells; ++f) {
+      const int l = std::max(f - 1, 0);
+      const int r = std::min(f, cells - 1);
+      for (int c = 0; c < 3; ++c) {
+         left[c] = T(q(3*l + c), 6, c);
+         right[c] = T(q(3*r + c), 6, 3 + c);
+      }
+      flux.clear();
+      roe_flux(left, right, flux);
+      if (f > 0) scatter(J, f - 1, l, r, flux, Number(1));
+      if (f < cells) scatter(J, f, l, r, flux, Number(-1));
+   }
+}
+
+// faces as elements: the unknowns of cells f-1 and f
+ADElements faces(int cells) {
+   ADElements elements;
+   elements.unknowns = 3*cells;
+   elements.size = 6;
+   elements.nodes.reserve(6*(cells + 1));
+   for (int f = 0; f <= cells; ++f) {
+      const int l = std::max(f - 1, 0);
+      const int r = std::min(f, cells - 1);
+      for (int c = 0; c < 3; ++c) elements.nodes.push_back(3*l + c);
+      for (int c = 0; c < 3; ++c) elements.nodes.push_back(3*r + c);
+   }
+   return elements;
+}
+
+// smooth subsonic initial state
+Eigen::VectorXf initial_state(int cells) {
+   Eigen::VectorXf q(3*cells);
+   for (int i = 0; i < cells; ++i) {
+      const double x = (i + 0.5)/cells;
+      const double rho = 1.0 + 0.2*std::sin(2*pi*x);
+      const double u = 0.3 + 0.1*std::cos(2*pi*x);
+      const double p = 1.0 + 0.2*std::sin(4*pi*x);
+      q(3*i) = Number(rho);
+      q(3*i + 1) = Number(rho*u);
+      q(3*i + 2) = Number(p/(gamma_gas - 1) + 0.5*rho*u*u);
+   }
+   return q;
+}
+
+
+void run(int cells, int repetitions) {
+
+   const Eigen::VectorXf q = initial_state(cells);
+   const std::vector<Number> state(q.data(), q.data() + q.size());
+
+   Number check = 0;
+   const double t_residual = best_seconds([&]() {
+      check = residual(state)[0];
+   }, repetitions);
+
+   Jacobian J;
+   const double t_setup = best_seconds([&]() { J = block_tridiagonal(cells); }, repetitions);
+   const double t_assemble = best_seconds([&]() { assemble(q, J); }, repetitions);
+
+   std::cout << "  N = " << cells
+             << "  residual: " << t_residual << " s (" << cells/t_residual/1.e6 << " Mcells/s)"
+             << "  Jacobian: " << t_assemble << " s (" << cells/t_assemble/1.e6 << " Mcells/s,"
+             << " " << t_assemble/t_residual << " residuals, + " << t_setup << " s structure)";
+
+   // +flux to the left cell, -flux to the right one, one of them at the
+   // boundary faces
+   auto face = [cells](int f, const std::array<T, 6>& local, std::array<T, 6>& out) {
+      thread_local std::vector<T> flux;
+      flux.clear();
+      roe_flux(&local[0], &local[3], flux);
+      for (int c = 0; c < 3; ++c) {
+         out[c] = (f > 0) ? flux[c] : T(Number(0));
+         out[3 + c] = (f < cells) ? T(-flux[c]) : T(Number(0));
+      }
+   };
+   const ADElements elements = faces(cells);
+   ADAssembly plan;
+   const double t_plan = best_seconds([&]() { plan = element_assembly(elements); }, 1);
+   ADAssembled<Number> assembled;
+   const int threads = assembly_threads(0);
+   const double t_serial = best_seconds([&]() {
+      assemble_jacobian<6>(face, q, elements, plan, assembled, 1);
+   }, repetitions);
+   const double t_parallel = best_seconds([&]() {
+      assemble_jacobian<6>(face, q, elements, plan, assembled, threads);
+   }, repetitions);
+
+   std::cout << "\n           assemble_jacobian: " << t_serial << " s on 1 thread, "
+             << t_parallel << " s on " << threads << " (" << cells/t_parallel/1.e6 << " Mcells/s,"
+             << " + " << t_plan << " s pattern and " << plan.coloring.colors << " colors)"
+             << "  (diff " << Jacobian(assembled.matrix - J).norm()/J.norm() << ")";
+
+   if (cells <= 10000) {
+      Jacobian colored;
+      const double t_colored = best_seconds([&]() {
+         colored = sparse_jacobian([](const auto& u) { return residual(u); }, q);
+      }, 1);
+      std::cout << "  sparse_jacobian: " << t_colored << " s"
+                << " (diff " << Jacobian(colored - J).norm()/J.norm() << ")";
+   }
+   std::cout << std::endl;
+   if (check != check) std::cout << "  residual is not finite" << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+
+   const int largest = (argc > 1) ? std::atoi(argv[1]) : 1000000;
+   const int repetitions = (argc > 2) ? std::atoi(argv[2]) : 5;
+
+   std::cout << "1D Euler, first order Roe: residual and flux Jacobian per cell count" << std::endl;
+
+   for (int cells = 100; cells <= largest; cells *= 10) run(cells, repetitions);
+
+   return 0;
+}
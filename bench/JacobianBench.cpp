@@ -0,0 +1,68 @@
+// Thread scaling benchmark: the m x n Jacobian of a residual vector by
+// jacobian<K>() on 1, 2, 4, ... threads up to the hardware threads.
+//
+// usage> ./run/JacobianBench [n]
+
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "../include/ADJacobian.h"
+
+
+// 1D diffusion-reaction residual with a nonlocal coupling to x[0],
+// written once for any AD flavour
+template <typename T>
+std::vector<T> residual(const std::vector<T>& x) {
+   const std::size_t n = x.size();
+   std::vector<T> r;
+   r.reserve(n);
+   for (std::size_t i = 0; i < n; ++i) {
+      const T& left = x[i == 0 ? n - 1 : i - 1];
+      const T& right = x[i + 1 == n ? 0 : i + 1];
+      r.push_back(left - 2.0f*x[i] + right + 0.1f*exp(x[i])*x[0]);
+   }
+   return r;
+}
+
+template <typename F>
+double best_seconds(F f, int repetitions) {
+   double best = 1.e30;
+   for (int r = 0; r < repetitions; ++r) {
+      auto t0 = std::chrono::steady_clock::now();
+      f();
+      auto t1 = std::chrono::steady_clock::now();
+      best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+   }
+   return best;
+}
+
+
+int main(int argc, char** argv) {
+
+   const int n = (argc > 1) ? std::atoi(argv[1]) : 1024;
+   const int hardware = std::max(1, int(std::thread::hardware_concurrency()));
+
+   Eigen::VectorXf x(n);
+   for (int i = 0; i < n; ++i) x(i) = Number(0.5) + Number((i*13) % 101)/Number(101);
+
+   auto f = [](const auto& v) { return residual(v); };
+
+   std::cout << "Jacobian of a residual, n = m = " << n
+             << ", K = 16, " << hardware << " hardware threads" << std::endl;
+
+   Eigen::MatrixXf reference;
+   double serial = best_seconds([&]() { reference = jacobian<16>(f, x, 1); }, 3);
+   std::cout << "  1 thread: " << serial << " s" << std::endl;
+
+   for (int threads = 2; threads <= hardware; threads *= 2) {
+      Eigen::MatrixXf J;
+      double seconds = best_seconds([&]() { J = jacobian<16>(f, x, threads); }, 3);
+      std::cout << "  " << threads << " threads: " << seconds << " s"
+                << "  speedup: " << serial/seconds
+                << "  (diff " << (J - reference).norm() << ")" << std::endl;
+   }
+
+   return 0;
+}
@@ -0,0 +1,162 @@
+// Sparse derivative benchmark: 1D and 2D stencil residuals, dense
+// chunked_jacobian<16> versus sparse_jacobian with a column coloring,
+// and a chained objective, the dense AD<> Hessian versus
+// sparse_hessian with a star coloring, and the same two by forward over
+// reverse on an ADHessianTape.
+//
+// usage> ./run/SparseBench [cells per direction]
+
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+
+#include "../include/ADChunk.h"
+#include "../include/ADColoring.h"
+
+
+// nonlinear diffusion on a line of n cells
+template <typename T>
+std::vector<T> residual_1d(const std::vector<T>& u) {
+   const std::size_t n = u.size();
+   std::vector<T> r;
+   r.reserve(n);
+   for (std::size_t i = 0; i < n; ++i) {
+      T s = -2.0f*u[i] + 0.1f*exp(u[i]);
+      if (i > 0) s += u[i-1]*u[i];
+      if (i + 1 < n) s += u[i+1];
+      r.push_back(s);
+   }
+   return r;
+}
+
+// five point stencil on an m x m grid
+template <typename T>
+std::vector<T> residual_2d(const std::vector<T>& u) {
+   const int m = int(std::sqrt(double(u.size())) + 0.5);
+   std::vector<T> r;
+   r.reserve(u.size());
+   for (int j = 0; j < m; ++j) {
+      for (int i = 0; i < m; ++i) {
+         const int c = j*m + i;
+         T s = -4.0f*u[c] + 0.1f*u[c]*u[c];
+         if (i > 0) s += u[c-1];
+         if (i + 1 < m) s += u[c+1];
+         if (j > 0) s += u[c-m];
+         if (j + 1 < m) s += u[c+m];
+         r.push_back(s);
+      }
+   }
+   return r;
+}
+
+// chained Rosenbrock type objective: tridiagonal Hessian
+template <typename T>
+T objective(const std::vector<T>& u) {
+   T f = u[0]*u[0];
+   for (std::size_t i = 1; i < u.size(); ++i) {
+      T t = u[i] - u[i-1]*u[i-1];
+      f += 100.0f*t*t + exp(u[i])*u[i];
+   }
+   return f;
+}
+
+template <typename F>
+double best_seconds(F f, int repetitions) {
+   double best = 1.e30;
+   for (int r = 0; r < repetitions; ++r) {
+      auto t0 = std::chrono::steady_clock::now();
+      f();
+      auto t1 = std::chrono::steady_clock::now();
+      best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+   }
+   return best;
+}
+
+template <typename F>
+void compare(const char* name, F f, int n) {
+
+   Eigen::VectorXf x(n);
+   for (int i = 0; i < n; ++i) x(i) = Number(0.5) + Number((i*13) % 101)/Number(101);
+
+   Eigen::MatrixXf dense;
+   double t_dense = best_seconds([&]() { dense = chunked_jacobian<16>(f, x); }, 3);
+
+   ADSparsity pattern;
+   ADColoring coloring;
+   double t_setup = best_seconds([&]() {
+      pattern = jacobian_sparsity(f, x);
+      coloring = column_coloring(pattern);
+   }, 3);
+
+   Eigen::SparseMatrix<Number, Eigen::RowMajor> sparse;
+   double t_sparse = best_seconds([&]() { sparse = sparse_jacobian(f, x, pattern, coloring); }, 3);
+
+   std::cout << "  " << name << ": n = " << n << ", " << coloring.colors << " colors"
+             << "  dense: " << t_dense << " s"
+             << "  sparse: " << t_sparse << " s (+ " << t_setup << " s pattern and coloring)"
+             << "  speedup: " << t_dense/t_sparse
+             << "  (diff " << (Eigen::MatrixXf(sparse) - dense).norm() << ")" << std::endl;
+}
+
+template <typename F>
+void compare_hessian(const char* name, F f, int n) {
+
+   Eigen::VectorXf x(n);
+   for (int i = 0; i < n; ++i) x(i) = Number(0.5) + Number((i*13) % 101)/Number(101);
+
+   Eigen::MatrixXf dense;
+   double t_dense = best_seconds([&]() {
+      std::vector< AD<> > vars;
+      vars.reserve(n);
+      for (int i = 0; i < n; ++i) vars.emplace_back(x(i), n, i);
+      dense = AD<>(f(vars)).hess.dense();
+   }, 3);
+
+   ADSparsity pattern;
+   ADColoring coloring;
+   double t_setup = best_seconds([&]() {
+      pattern = hessian_sparsity(f, x);
+      coloring = star_coloring(pattern);
+   }, 3);
+
+   Eigen::SparseMatrix<Number, Eigen::RowMajor> sparse;
+   double t_sparse = best_seconds([&]() { sparse = sparse_hessian<4>(f, x, pattern, coloring); }, 3);
+
+   std::cout << "  " << name << ": n = " << n << ", " << coloring.colors << " colors"
+             << "  dense: " << t_dense << " s"
+             << "  sparse: " << t_sparse << " s (+ " << t_setup << " s pattern and coloring)"
+             << "  speedup: " << t_dense/t_sparse
+             << "  (diff " << (Eigen::MatrixXf(sparse) - dense).norm()/dense.norm() << ")" << std::endl;
+
+   ADHessianTape<> tape;
+   Eigen::MatrixXf reverse;
+   double t_reverse = best_seconds([&]() { reverse = reverse_hessian(f, x, tape); }, 3);
+   double t_reverse_sparse = best_seconds([&]() {
+      sparse = reverse_sparse_hessian(f, x, pattern, coloring, tape);
+   }, 3);
+
+   std::cout << "  " << name << " forward over reverse:"
+             << "  dense: " << t_reverse << " s"
+             << "  speedup: " << t_dense/t_reverse
+             << "  (diff " << (reverse - dense).norm()/dense.norm() << ")"
+             << "  colored: " << t_reverse_sparse << " s"
+             << "  speedup: " << t_dense/t_reverse_sparse
+             << "  (diff " << (Eigen::MatrixXf(sparse) - dense).norm()/dense.norm() << ")" << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+
+   const int m = (argc > 1) ? std::atoi(argv[1]) : 40;
+
+   std::cout << "stencil Jacobians, dense chunks of 16 vs colored" << std::endl;
+
+   compare("1D", [](const auto& u) { return residual_1d(u); }, m*m);
+   compare("2D", [](const auto& u) { return residual_2d(u); }, m*m);
+
+   std::cout << "objective Hessian, dense AD<> vs star colored" << std::endl;
+
+   compare_hessian("chain", [](const auto& u) { return objective(u); }, 5*m);
+
+   return 0;
+}
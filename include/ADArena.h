@@ -0,0 +1,257 @@
+#ifndef AD_ARENA_H
+#define AD_ARENA_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "GetEigen.h"
+#include "ADStats.h"
+
+
+// Bump allocator for the derivative storage of run time sized AD
+// variables (AD<>, and the temporaries of its expression templates).
+//
+// Each thread has an optional *current* arena.  While one is active,
+// every AD<> gradient/Hessian buffer is carved out of it by bumping a
+// pointer, and freeing is a no-op.  ADArenaScope makes an arena current
+// and releases everything allocated in it at once on exit:
+//
+//    ADArena arena;                  // reuse across evaluations
+//    for (...) {
+//       ADArenaScope scope(arena);   // this evaluation allocates here
+//       AD<> f = residual(x);
+//       J.row(i) = f.grad;           // copy results out before the scope ends
+//    }
+//
+// AD<> variables allocated in the arena must not outlive the scope;
+// assigning one to a variable declared outside copies it out.
+// With no arena active, storage comes from the heap as before.
+class ADArena {
+
+   public:
+
+   static constexpr std::size_t alignment = 64;
+
+   explicit ADArena(std::size_t block_bytes = std::size_t(1) << 20)
+      : block_bytes(block_bytes), block(0), offset(0), in_use(0), high_water(0) {}
+
+   ~ADArena() {
+      for (auto& b : blocks) Eigen::internal::aligned_free(b.first);
+   }
+
+   ADArena(const ADArena&) = delete;
+   ADArena& operator=(const ADArena&) = delete;
+
+   void* allocate(std::size_t bytes);
+
+   // release every allocation at once; the blocks are kept for reuse
+   void reset() {
+      block = 0;
+      offset = 0;
+      in_use = 0;
+   }
+
+   std::size_t bytes_in_use() const { return in_use; }
+   std::size_t peak_bytes() const { return high_water; }
+
+   // the arena AD<> storage on this thread draws from (nullptr = heap)
+   static ADArena*& current() {
+      thread_local ADArena* arena = nullptr;
+      return arena;
+   }
+
+   private:
+
+   std::size_t block_bytes;
+   std::vector< std::pair<char*, std::size_t> > blocks;
+   std::size_t block;    // block being bumped
+   std::size_t offset;   // first free byte in that block
+   std::size_t in_use;
+   std::size_t high_water;
+
+};
+
+
+inline void* ADArena::allocate(std::size_t bytes) {
+
+   bytes = (bytes + alignment - 1) & ~(alignment - 1);
+
+   while (block < blocks.size() && offset + bytes > blocks[block].second) {
+      ++block;
+      offset = 0;
+   }
+   if (block == blocks.size()) {
+      std::size_t size = std::max(block_bytes, bytes);
+      blocks.push_back(std::make_pair(
+         static_cast<char*>(Eigen::internal::aligned_malloc(size)), size));
+      offset = 0;
+   }
+
+   void* p = blocks[block].first + offset;
+   offset += bytes;
+   in_use += bytes;
+   high_water = std::max(high_water, in_use);
+   return p;
+}
+
+
+// Makes `arena` the current arena of this thread for its lifetime and
+// resets it on exit.  Scopes nest; the previous arena is restored.
+class ADArenaScope {
+
+   public:
+
+   explicit ADArenaScope(ADArena& arena) : arena(arena), previous(ADArena::current()) {
+      ADArena::current() = &arena;
+   }
+
+   ~ADArenaScope() {
+      ADArena::current() = previous;
+      arena.reset();
+   }
+
+   ADArenaScope(const ADArenaScope&) = delete;
+   ADArenaScope& operator=(const ADArenaScope&) = delete;
+
+   private:
+
+   ADArena& arena;
+   ADArena* previous;
+
+};
+
+
+
+// Dynamic length Eigen vector whose buffer comes from the ADArena that
+// was current when the vector was constructed, or from the (aligned)
+// heap when there was none.  Later resizes and assignments keep that
+// owner, so a vector declared outside an ADArenaScope never picks up
+// storage that dies with the scope.
+// It is an Eigen::Map re-seated on every resize, so it takes part in
+// Eigen expressions exactly like a VectorX.
+template <typename Scalar>
+class ArenaVector : public Eigen::Map< Eigen::Matrix<Scalar, Dynamic, 1>, Eigen::AlignedMax > {
+
+   public:
+
+   typedef Eigen::Map< Eigen::Matrix<Scalar, Dynamic, 1>, Eigen::AlignedMax > Base;
+   typedef Eigen::Index Index;
+
+   ArenaVector() : Base(nullptr, 0), owner(ADArena::current()) {}
+
+   explicit ArenaVector(Index size) : Base(nullptr, 0), owner(ADArena::current()) { resize(size); }
+
+   ArenaVector(const ArenaVector& other) : Base(nullptr, 0), owner(ADArena::current()) {
+      resize(other.size());
+      Base::operator=(other);
+   }
+
+   ArenaVector(ArenaVector&& other) noexcept
+      : Base(other.data(), other.size()), owner(other.owner) {
+      other.reseat(nullptr, 0);
+   }
+
+   template <typename OtherDerived>
+   ArenaVector(const Eigen::DenseBase<OtherDerived>& other) : Base(nullptr, 0), owner(ADArena::current()) {
+      assign(other);
+   }
+
+   ~ArenaVector() { deallocate(); }
+
+   ArenaVector& operator=(const ArenaVector& other) {
+      if (this != &other) assign(other);
+      return *this;
+   }
+
+   // buffers are swapped only between vectors of the same arena (or
+   // both on the heap): a heap vector must not pick up arena storage
+   // that dies with a scope, so otherwise the values are copied into
+   // storage from this vector's own arena (or the heap)
+   ArenaVector& operator=(ArenaVector&& other) {
+      if (owner != other.owner) {
+         if (other.size() != this->size()) {
+            deallocate();
+            reseat(allocate(other.size()), other.size());
+         }
+         Base::operator=(other);
+         return *this;
+      }
+      Scalar* p = this->data();
+      Index n = this->size();
+      reseat(other.data(), other.size());
+      other.reseat(p, n);
+      return *this;
+   }
+
+   template <typename OtherDerived>
+   ArenaVector& operator=(const Eigen::DenseBase<OtherDerived>& other) {
+      assign(other);
+      return *this;
+   }
+
+   void resize(Index size) {
+      if (size == this->size()) return;
+      deallocate();
+      reseat(allocate(size), size);
+   }
+
+   using Base::setZero;
+   ArenaVector& setZero(Index size) {
+      resize(size);
+      Base::setZero();
+      return *this;
+   }
+
+   private:
+
+   // arena the buffer comes from, nullptr for the heap; fixed at
+   // construction (or taken over with the buffer by a move)
+   ADArena* owner;
+
+   void reseat(Scalar* p, Index size) {
+      // the documented way to point an Eigen::Map at a new array
+      new (static_cast<Base*>(this)) Base(p, size);
+   }
+
+   Scalar* allocate(Index size) {
+      if (size == 0) return nullptr;
+      std::size_t bytes = std::size_t(size)*sizeof(Scalar);
+      ad_stats::allocation(bytes, owner != nullptr);
+      if (owner) return static_cast<Scalar*>(owner->allocate(bytes));
+      return static_cast<Scalar*>(Eigen::internal::aligned_malloc(bytes));
+   }
+
+   void deallocate() {
+      if (!owner && this->data()) Eigen::internal::aligned_free(this->data());
+      reseat(nullptr, 0);
+   }
+
+   // the source may alias the old buffer: fill a new one before freeing
+   template <typename OtherDerived>
+   void assign(const Eigen::DenseBase<OtherDerived>& other) {
+      const Index size = other.size();
+      if (size == this->size()) {
+         Base::operator=(other);
+         return;
+      }
+      Scalar* old = this->data();
+      Scalar* p = allocate(size);
+      Base(p, size) = other;
+      reseat(p, size);
+      if (!owner && old) Eigen::internal::aligned_free(old);
+   }
+
+};
+
+
+// Storage type for a length-Rows vector of AD derivatives:
+// fixed size Eigen vectors stay inline, Dynamic ones use ArenaVector.
+template <typename Scalar, int Rows>
+struct ADVectorType { typedef Eigen::Matrix<Scalar, Rows, 1> Type; };
+
+template <typename Scalar>
+struct ADVectorType<Scalar, Dynamic> { typedef ArenaVector<Scalar> Type; };
+
+
+#endif
@@ -0,0 +1,345 @@
+#ifndef AD_ASSEMBLY_H
+#define AD_ASSEMBLY_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ADColoring.h"
+
+
+// Element assembly of sparse gradients, Hessians and Jacobians.
+//
+// Many objectives and residuals are sums of element kernels (cells,
+// faces, finite elements) that each depend on K << n unknowns.  Seeding
+// AD<> over all n unknowns makes every local operation carry n-sized
+// derivatives.  Here each kernel runs on AD<K> (or ADGradient<K>) over
+// its own K unknowns, so an operation costs O(K^2) however large n is,
+// and the local gradient and Hessian (or Jacobian rows) are added into
+// the global vector and CSR matrix through the element's local to
+// global map.
+//
+// Elements that share an unknown write the same rows.  The elements
+// are therefore colored (column_coloring of the unknown x element
+// incidence: elements sharing an unknown get different colors) and
+// each color is cut into contiguous blocks, one per thread.  Within a
+// color no two elements touch the same row, so the scatter needs no
+// atomics or locks, only a barrier between colors.  Objective values are
+// summed per thread in a fixed order, so for a given thread count the
+// result does not depend on scheduling.
+//
+//    ADElements mesh{n, 2, nodes};               // 2 unknowns per element
+//    ADAssembly plan = element_assembly(mesh);   // pattern and coloring, once
+//    ADAssembled<float> h;
+//    assemble_hessian<2>(energy, x, mesh, plan, h);
+//
+// where energy(e, local) returns the AD<2> energy of element e on its
+// local variables.  The kernel is called concurrently from all
+// threads, so it must not modify shared state.  threads = 0 uses
+// std::thread::hardware_concurrency().
+
+
+// element e holds the unknowns nodes[e*size + a], a < size.  An unknown
+// may appear twice in one element (e.g. a boundary face between a cell
+// and its mirror image); its contributions add up.
+struct ADElements {
+   int unknowns = 0;
+   int size = 0;
+   std::vector<int> nodes;
+
+   int count() const { return size > 0 ? int(nodes.size())/size : 0; }
+};
+
+// everything the assembly needs besides x, computed once per mesh
+struct ADAssembly {
+   ADSparsity pattern;           // i ~ j when an element holds both
+   std::vector<int> position;    // value index of (a, b) of element e at (e*size + a)*size + b
+   ADColoring coloring;          // of the elements
+   std::vector<int> color_ptr;   // color c is order[color_ptr[c] .. color_ptr[c+1])
+   std::vector<int> order;
+};
+
+// objective, gradient and Hessian (assemble_hessian), or residual and
+// Jacobian with value 0 (assemble_jacobian).  Keep one across Newton
+// steps to reuse its storage.
+template <typename Scalar>
+struct ADAssembled {
+   Scalar value = 0;
+   Eigen::Matrix<Scalar, Dynamic, 1> vector;
+   Eigen::SparseMatrix<Scalar, Eigen::RowMajor> matrix;
+};
+
+
+inline ADAssembly element_assembly(const ADElements& elements) {
+
+   const int n = elements.unknowns;
+   const int k = elements.size;
+   const int count = elements.count();
+   const std::vector<int>& nodes = elements.nodes;
+
+   // first occurrence of an unknown within its element
+   auto first = [&](int e, int a) {
+      for (int b = 0; b < a; ++b) if (nodes[e*k + b] == nodes[e*k + a]) return false;
+      return true;
+   };
+
+   // unknown -> elements (CSR), each element once per unknown
+   ADSparsity incidence;
+   incidence.rows = n;
+   incidence.cols = count;
+   incidence.row_ptr.assign(n + 1, 0);
+   for (int e = 0; e < count; ++e) {
+      for (int a = 0; a < k; ++a) if (first(e, a)) ++incidence.row_ptr[nodes[e*k + a] + 1];
+   }
+   for (int i = 0; i < n; ++i) incidence.row_ptr[i + 1] += incidence.row_ptr[i];
+   incidence.col_idx.resize(incidence.row_ptr[n]);
+   std::vector<int> fill(incidence.row_ptr.begin(), incidence.row_ptr.end() - 1);
+   for (int e = 0; e < count; ++e) {
+      for (int a = 0; a < k; ++a) if (first(e, a)) incidence.col_idx[fill[nodes[e*k + a]]++] = e;
+   }
+
+   ADAssembly result;
+
+   // row i: the unknowns of every element that holds i
+   ADSparsity& pattern = result.pattern;
+   pattern.rows = n;
+   pattern.cols = n;
+   pattern.row_ptr.reserve(n + 1);
+   pattern.row_ptr.push_back(0);
+   std::vector<int> marker(n, -1);
+   for (int i = 0; i < n; ++i) {
+      for (int l = incidence.row_ptr[i]; l < incidence.row_ptr[i + 1]; ++l) {
+         const int e = incidence.col_idx[l];
+         for (int b = 0; b < k; ++b) {
+            const int j = nodes[e*k + b];
+            if (marker[j] == i) continue;
+            marker[j] = i;
+            pattern.col_idx.push_back(j);
+         }
+      }
+      std::sort(pattern.col_idx.begin() + pattern.row_ptr[i], pattern.col_idx.end());
+      pattern.row_ptr.push_back(int(pattern.col_idx.size()));
+   }
+
+   result.position.resize(std::size_t(count)*k*k);
+   for (int e = 0; e < count; ++e) {
+      for (int a = 0; a < k; ++a) {
+         const int i = nodes[e*k + a];
+         const auto row = pattern.col_idx.begin() + pattern.row_ptr[i];
+         const auto end = pattern.col_idx.begin() + pattern.row_ptr[i + 1];
+         for (int b = 0; b < k; ++b) {
+            result.position[(std::size_t(e)*k + a)*k + b] =
+               int(std::lower_bound(row, end, nodes[e*k + b]) - pattern.col_idx.begin());
+         }
+      }
+   }
+
+   // elements grouped by color
+   result.coloring = column_coloring(incidence);
+   result.color_ptr.assign(result.coloring.colors + 1, 0);
+   for (int c : result.coloring.color) ++result.color_ptr[c + 1];
+   for (int c = 0; c < result.coloring.colors; ++c) result.color_ptr[c + 1] += result.color_ptr[c];
+   result.order.resize(count);
+   fill.assign(result.color_ptr.begin(), result.color_ptr.end() - 1);
+   for (int e = 0; e < count; ++e) result.order[fill[result.coloring.color[e]]++] = e;
+
+   return result;
+}
+
+
+inline int assembly_threads(int threads) {
+   if (threads <= 0) threads = int(std::thread::hardware_concurrency());
+   return std::max(1, threads);
+}
+
+// the threads of one call wait here until all of them have arrived
+// (a generation count, as C++17 has no std::barrier)
+class ADBarrier {
+
+   public:
+
+   explicit ADBarrier(int count) : count(count) {}
+
+   void wait() {
+      std::unique_lock<std::mutex> lock(mutex);
+      const long long generation = this->generation;
+      if (++arrived == count) {
+         arrived = 0;
+         ++this->generation;
+         released.notify_all();
+      }
+      else {
+         released.wait(lock, [&]() { return this->generation != generation; });
+      }
+   }
+
+   private:
+
+   std::mutex mutex;
+   std::condition_variable released;
+   const int count;
+   int arrived = 0;
+   long long generation = 0;
+};
+
+// body(first, last, t) on thread t for the elements order[first .. last)
+// of one color; colors run one after another.  Small colors use fewer
+// threads.  The workers are started once per call and meet at a
+// barrier between colors.
+template <typename Body>
+void for_each_color(const ADAssembly& assembly, int threads, const Body& body) {
+
+   const int grain = 256;
+   const int colors = assembly.coloring.colors;
+
+   // threads used by color c
+   auto used = [&](int c) {
+      const long long width = assembly.color_ptr[c + 1] - assembly.color_ptr[c];
+      return int(std::max(1LL, std::min<long long>(threads, width/grain)));
+   };
+   int started = 1;
+   for (int c = 0; c < colors; ++c) started = std::max(started, used(c));
+
+   ADBarrier barrier(started);
+   std::exception_ptr error;
+   std::atomic<bool> failed(false);
+
+   auto worker = [&](int t) {
+      for (int c = 0; c < colors; ++c) {
+         const int begin = assembly.color_ptr[c];
+         const long long width = assembly.color_ptr[c + 1] - begin;
+         const int parts = used(c);
+         if (t < parts && !failed) {
+            try {
+               body(begin + int(width*t/parts), begin + int(width*(t + 1)/parts), t);
+            }
+            catch (...) {
+               // keep the first error; the others skip their remaining work
+               if (!failed.exchange(true)) error = std::current_exception();
+            }
+         }
+         if (c + 1 < colors) barrier.wait();
+      }
+   };
+
+   // the calling thread is one of the workers
+   std::vector<std::thread> pool;
+   pool.reserve(started - 1);
+   for (int t = 1; t < started; ++t) pool.emplace_back(worker, t);
+   worker(0);
+   for (auto& t : pool) t.join();
+
+   if (error) std::rethrow_exception(error);
+}
+
+// CSR structure of the pattern with zero values, zero vector and value
+template <typename Scalar>
+void assembly_reset(ADAssembled<Scalar>& result, const ADAssembly& assembly) {
+   const ADSparsity& pattern = assembly.pattern;
+   Eigen::SparseMatrix<Scalar, Eigen::RowMajor>& M = result.matrix;
+   M.resize(pattern.rows, pattern.cols);
+   M.resizeNonZeros(pattern.nonZeros());
+   std::copy(pattern.row_ptr.begin(), pattern.row_ptr.end(), M.outerIndexPtr());
+   std::copy(pattern.col_idx.begin(), pattern.col_idx.end(), M.innerIndexPtr());
+   std::fill(M.valuePtr(), M.valuePtr() + pattern.nonZeros(), Scalar(0));
+   result.vector.setZero(pattern.rows);
+   result.value = 0;
+}
+
+
+//-------------------------
+// objective f = sum_e kernel(e, local) with its gradient and sparse
+// Hessian (both triangles).  local is a std::array of K AD<K, 2,
+// Scalar> variables, local[a] seeded at x(nodes[e*K + a]).
+template <int K, typename Scalar, typename F>
+void assemble_hessian(const F& kernel, const Eigen::Matrix<Scalar, Dynamic, 1>& x,
+                      const ADElements& elements, const ADAssembly& assembly,
+                      ADAssembled<Scalar>& result, int threads = 0) {
+
+   static_assert(K > 0, "the element size must be fixed");
+   eigen_assert(elements.size == K && int(x.size()) == elements.unknowns);
+
+   typedef AD<K, 2, Scalar> T;
+
+   assembly_reset(result, assembly);
+   threads = assembly_threads(threads);
+   std::vector<Scalar> partial(threads, Scalar(0));
+   Scalar* values = result.matrix.valuePtr();
+
+   for_each_color(assembly, threads, [&](int first, int last, int t) {
+      std::array<T, K> local;
+      for (int l = first; l < last; ++l) {
+         const int e = assembly.order[l];
+         const int* nodes = &elements.nodes[std::size_t(e)*K];
+         const int* position = &assembly.position[std::size_t(e)*K*K];
+         for (int a = 0; a < K; ++a) local[a] = T(x(nodes[a]), K, a);
+
+         const T f(kernel(e, local));
+         partial[t] += f.value;
+         for (int a = 0; a < K; ++a) {
+            result.vector(nodes[a]) += f.grad(a);
+            for (int b = 0; b < K; ++b) values[position[a*K + b]] += f.hess(a, b);
+         }
+      }
+   });
+
+   for (Scalar p : partial) result.value += p;
+}
+
+// residual r = sum_e of the element residuals and its sparse Jacobian.
+// kernel(e, local, out) fills out[a], the contribution of element e to
+// r(nodes[e*K + a]), as ADGradient<K, Scalar> of the local variables.
+template <int K, typename Scalar, typename F>
+void assemble_jacobian(const F& kernel, const Eigen::Matrix<Scalar, Dynamic, 1>& x,
+                       const ADElements& elements, const ADAssembly& assembly,
+                       ADAssembled<Scalar>& result, int threads = 0) {
+
+   static_assert(K > 0, "the element size must be fixed");
+   eigen_assert(elements.size == K && int(x.size()) == elements.unknowns);
+
+   typedef ADGradient<K, Scalar> T;
+
+   assembly_reset(result, assembly);
+   Scalar* values = result.matrix.valuePtr();
+
+   for_each_color(assembly, assembly_threads(threads), [&](int first, int last, int) {
+      std::array<T, K> local, out;
+      for (int l = first; l < last; ++l) {
+         const int e = assembly.order[l];
+         const int* nodes = &elements.nodes[std::size_t(e)*K];
+         const int* position = &assembly.position[std::size_t(e)*K*K];
+         for (int a = 0; a < K; ++a) local[a] = T(x(nodes[a]), K, a);
+
+         kernel(e, local, out);
+         for (int a = 0; a < K; ++a) {
+            result.vector(nodes[a]) += out[a].value;
+            for (int b = 0; b < K; ++b) values[position[a*K + b]] += out[a].grad(b);
+         }
+      }
+   });
+}
+
+// the same, building the pattern and coloring first
+template <int K, typename Scalar, typename F>
+ADAssembled<Scalar> assemble_hessian(const F& kernel, const Eigen::Matrix<Scalar, Dynamic, 1>& x,
+                                     const ADElements& elements, int threads = 0) {
+   ADAssembled<Scalar> result;
+   assemble_hessian<K>(kernel, x, elements, element_assembly(elements), result, threads);
+   return result;
+}
+
+template <int K, typename Scalar, typename F>
+ADAssembled<Scalar> assemble_jacobian(const F& kernel, const Eigen::Matrix<Scalar, Dynamic, 1>& x,
+                                      const ADElements& elements, int threads = 0) {
+   ADAssembled<Scalar> result;
+   assemble_jacobian<K>(kernel, x, elements, element_assembly(elements), result, threads);
+   return result;
+}
+
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef AD_BATCH_H
+#define AD_BATCH_H
+
+#include <string>
+
+#include "AutomaticDifferentiation.h"
+
+
+// W evaluation points of the same function carried in lockstep
+// (structure of arrays).  Lane w of every member belongs to point w.
+//
+//    value   W         one SIMD packet
+//    grad    W x n     column i = d/dx_i at every point
+//    hess    W x n(n+1)/2   packed upper triangle, one column per entry
+//
+// Storage is column major with the lanes innermost, so every column is
+// a contiguous packet and each product/quotient rule term is a
+// packet-wide multiply-add.  With W*sizeof(Scalar) equal to the vector
+// width (W = 8 floats or 4 doubles for AVX2, twice that for AVX-512,
+// compiled with -march=native) Eigen maps each column onto one register.
+template <int W, int N = Dynamic, typename Scalar = Number>
+class ADBatch {
+
+   public:
+
+   static constexpr int Packed = SymmetricMatrix<Scalar, N>::Packed;
+
+   typedef Scalar Value;
+   typedef Eigen::Array<Scalar, W, 1> Lanes;
+   typedef Eigen::Array<Scalar, W, N> Gradient;
+   typedef Eigen::Array<Scalar, W, Packed> Hessian;
+
+   Lanes value;
+   Gradient grad;
+   Hessian hess;
+
+   // number of design space dimensions
+   int space_dim;
+
+   // location in the gradient space
+   int index;
+
+   // AD variables can have a name
+   std::string name;
+
+
+   // constructor for base variable initilization
+   ADBatch(const Lanes& val, int space_size, int grad_index, std::string name="ADvar"){
+      eigen_assert(N == Dynamic || space_size == N);
+      value = val;
+      space_dim = space_size;
+      index = grad_index;
+      this->name = name;
+
+      grad.setZero(W, space_size);
+      hess.setZero(W, SymmetricMatrix<Scalar>::packed_size(space_size));
+
+      grad.col(index).setOnes();
+   }
+
+
+   // constructor for operations
+   ADBatch(const Lanes& val, int space_size, std::string name="ADvar"){
+      eigen_assert(N == Dynamic || space_size == N);
+      value = val;
+      space_dim = space_size;
+      index = -1;
+      this->name = name;
+
+      grad.setZero(W, space_size);
+      hess.setZero(W, SymmetricMatrix<Scalar>::packed_size(space_size));
+   }
+
+   // one lane as a plain AD
+   AD<N, 2, Scalar> lane(int w) const;
+
+   //-------------------------
+   // unary operations
+   ADBatch operator-() const;
+
+   //-------------------------
+   // binary operations
+   ADBatch operator+(const ADBatch& other) const;
+   ADBatch operator-(const ADBatch& other) const;
+   ADBatch operator*(const ADBatch& other) const;
+   ADBatch operator/(const ADBatch& other) const;
+
+   ADBatch operator+(Scalar other) const;
+   ADBatch operator-(Scalar other) const;
+   ADBatch operator*(Scalar other) const;
+   ADBatch operator/(Scalar other) const;
+
+   //-------------------------
+   // printing
+   void print() const;
+
+   private:
+
+   // hess += alpha .* (u v^T + v u^T), lane by lane, alpha per lane
+   template <typename U, typename V, typename A>
+   void rankUpdate(const U& u, const V& v, const A& alpha);
+
+};
+
+
+
+template <int W, int N, typename Scalar>
+AD<N, 2, Scalar> ADBatch<W, N, Scalar>::lane(int w) const {
+   AD<N, 2, Scalar> result(value(w), space_dim);
+   result.grad = grad.row(w).transpose().matrix();
+   result.hess.data = hess.row(w).transpose().matrix();
+   return result;
+}
+
+template <int W, int N, typename Scalar>
+template <typename U, typename V, typename A>
+void ADBatch<W, N, Scalar>::rankUpdate(const U& u, const V& v, const A& alpha) {
+   // compile time bound when N is fixed, so the loops unroll
+   const int n = (N == Dynamic) ? space_dim : N;
+   int k = 0;
+   for (int j = 0; j < n; ++j) {
+      const Lanes uj = alpha*u.col(j);
+      const Lanes vj = alpha*v.col(j);
+      for (int i = 0; i <= j; ++i, ++k) {
+         hess.col(k) += u.col(i)*vj + v.col(i)*uj;
+      }
+   }
+}
+
+//-------------------------
+// unary operations
+template <int W, int N, typename Scalar>
+ADBatch<W, N, Scalar> ADBatch<W, N, Scalar>::operator-() const {
+   ADBatch result(-value, space_dim);
+   result.grad = -grad;
+   result.hess = -hess;
+   return result;
+}
+
+//-------------------------
+// binary operations
+template <int W, int N, typename Scalar>
+ADBatch<W, N, Scalar> ADBatch<W, N, Scalar>::operator+(const ADBatch& other) const {
+   ADBatch result(value + other.value, space_dim);
+   result.grad = grad + other.grad;
+   result.hess = hess + other.hess;
+   return result;
+}
+
+template <int W, int N, typename Scalar>
+ADBatch<W, N, Scalar> ADBatch<W, N, Scalar>::operator-(const ADBatch& other) const {
+   ADBatch result(value - other.value, space_dim);
+   result.grad = grad - other.grad;
+   result.hess = hess - other.hess;
+   return result;
+}
+
+template <int W, int N, typename Scalar>
+ADBatch<W, N, Scalar> ADBatch<W, N, Scalar>::operator*(const ADBatch& other) const {
+   ADBatch result(value * other.value, space_dim);
+   result.grad = grad.colwise()*other.value + other.grad.colwise()*value;
+   result.hess = hess.colwise()*other.value + other.hess.colwise()*value;
+   result.rankUpdate(grad, other.grad, Lanes::Ones());
+   return result;
+}
+
+// same form as AD<N>: q = u/v,
+//    grad(q) = ( grad(u) - q*grad(v) ) / v
+//    hess(q) = ( hess(u) - q*hess(v) - grad(q)grad(v)^T - grad(v)grad(q)^T ) / v
+template <int W, int N, typename Scalar>
+ADBatch<W, N, Scalar> ADBatch<W, N, Scalar>::operator/(const ADBatch& other) const {
+   const Lanes inv = other.value.inverse();
+   ADBatch result(value * inv, space_dim);
+   result.grad = (grad - other.grad.colwise()*result.value).colwise()*inv;
+   result.hess = (hess - other.hess.colwise()*result.value).colwise()*inv;
+   result.rankUpdate(result.grad, other.grad, -inv);
+   return result;
+}
+
+//----------------------------------------------------------------------
+// left var is ADBatch, right var is Scalar
+template <int W, int N, typename Scalar>
+ADBatch<W, N, Scalar> ADBatch<W, N, Scalar>::operator+(Scalar other) const {
+   ADBatch result(value + other, space_dim);
+   result.grad = grad;
+   result.hess = hess;
+   return result;
+}
+
+template <int W, int N, typename Scalar>
+ADBatch<W, N, Scalar> ADBatch<W, N, Scalar>::operator-(Scalar other) const {
+   ADBatch result(value - other, space_dim);
+   result.grad = grad;
+   result.hess = hess;
+   return result;
+}
+
+template <int W, int N, typename Scalar>
+ADBatch<W, N, Scalar> ADBatch<W, N, Scalar>::operator*(Scalar other) const {
+   ADBatch result(value * other, space_dim);
+   result.grad = grad * other;
+   result.hess = hess * other;
+   return result;
+}
+
+template <int W, int N, typename Scalar>
+ADBatch<W, N, Scalar> ADBatch<W, N, Scalar>::operator/(Scalar other) const {
+   return (*this) * (Scalar(1) / other);
+}
+
+//-------------------------
+// printing
+template <int W, int N, typename Scalar>
+void ADBatch<W, N, Scalar>::print() const
+{
+   std::cout << "ADBatch(" << name << std::endl;
+   std::cout << " design space size: (" << space_dim << "), lanes: " << W << std::endl;
+   std::cout << " value: \n" << value.transpose() << "" << std::endl;
+   std::cout << " grad (row per lane): \n" << grad << "" << std::endl;
+   std::cout << "    )\n\n" << std::endl;
+}
+
+//-------------------------
+// r-operations (any arithmetic type, converted to Scalar)
+template <int W, int N, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADBatch<W, N, Scalar> operator+( U self , const ADBatch<W, N, Scalar>& other) {
+   return other + Scalar(self);
+}
+template <int W, int N, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADBatch<W, N, Scalar> operator-( U self , const ADBatch<W, N, Scalar>& other) {
+   return -other + Scalar(self);
+}
+template <int W, int N, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADBatch<W, N, Scalar> operator*( U self , const ADBatch<W, N, Scalar>& other) {
+   return other * Scalar(self);
+}
+template <int W, int N, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADBatch<W, N, Scalar> operator/( U self , const ADBatch<W, N, Scalar>& other) {
+   ADBatch<W, N, Scalar> numerator(ADBatch<W, N, Scalar>::Lanes::Constant(Scalar(self)), other.space_dim, "numerator");
+   return numerator / other;
+}
+
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef AD_CHUNK_H
+#define AD_CHUNK_H
+
+#include <algorithm>
+#include <vector>
+
+#include "AutomaticDifferentiation.h"
+
+
+// Gradients and Jacobians in chunks of K seed directions.
+//
+// Seeding every input against the full design space streams n-length
+// derivative vectors through every operation of the function.  Here
+// the n inputs are seeded K at a time: pass c gives input i in
+// [c*K, c*K + K) the unit direction i - c*K of an ADGradient<K>, and
+// every other input is a constant.  ceil(n/K) passes are stitched into
+// the full result.  The value is recomputed in every pass, but the
+// per-operation derivative vector is only K long, so it stays in L1/L2
+// for large n (see bench/ChunkBench.cpp to pick K for a machine).
+//
+// f is called with a std::vector of the AD variables and is written
+// once for any AD type, e.g.
+//
+//    auto f = [](const auto& x) { return x[0]*x[1] + sin(x[2]); };
+//    VectorXf g = chunked_gradient<8>(f, x0);
+//
+// K = Dynamic takes the chunk size at run time; its derivative storage
+// comes from an ADArena that is reset after every pass.
+
+
+// value-and-gradient variable type of one pass
+template <int K, typename Scalar>
+using ADChunkVariable = AD<K, 1, Scalar>;
+
+
+// seed the inputs x for the pass over columns [first, first + width)
+template <int K, typename Scalar>
+void chunk_seed(std::vector< ADChunkVariable<K, Scalar> >& vars,
+                const Eigen::Matrix<Scalar, Dynamic, 1>& x,
+                int chunk, int first, int width) {
+   vars.clear();
+   for (int i = 0; i < x.size(); ++i) {
+      if (i >= first && i < first + width) vars.emplace_back(x(i), chunk, i - first);
+      else vars.emplace_back(x(i), chunk);
+   }
+}
+
+
+// gradient of the scalar function f at x
+template <int K, typename Scalar, typename F>
+Eigen::Matrix<Scalar, Dynamic, 1> chunked_gradient(F f, const Eigen::Matrix<Scalar, Dynamic, 1>& x,
+                                                   int chunk = K) {
+
+   static_assert(K == Dynamic || K > 0, "chunk size must be positive");
+   eigen_assert(chunk > 0);
+
+   const int n = int(x.size());
+   Eigen::Matrix<Scalar, Dynamic, 1> gradient(n);
+
+   ADArena arena;
+   std::vector< ADChunkVariable<K, Scalar> > vars;
+   vars.reserve(n);
+
+   for (int first = 0; first < n; first += chunk) {
+      const int width = std::min(chunk, n - first);
+      ADArenaScope scope(arena);
+      chunk_seed<K>(vars, x, chunk, first, width);
+      const ADChunkVariable<K, Scalar> result = f(vars);
+      gradient.segment(first, width) = result.grad.head(width);
+      vars.clear();
+   }
+   return gradient;
+}
+
+
+// one pass of a Jacobian driver: columns [first, first + width) of J,
+// with vars as the workspace for the seeded inputs.  In column major
+// storage those columns are one contiguous block of J.
+template <int K, typename Scalar, typename F, typename Jacobian>
+void chunk_jacobian_pass(F& f, const Eigen::Matrix<Scalar, Dynamic, 1>& x,
+                         std::vector< ADChunkVariable<K, Scalar> >& vars,
+                         int chunk, int first, int width, Jacobian& J) {
+   chunk_seed<K>(vars, x, chunk, first, width);
+   const auto result = f(vars);
+   for (int r = 0; r < int(result.size()); ++r) {
+      const ADChunkVariable<K, Scalar> row(result[r]);
+      J.row(r).segment(first, width) = row.grad.head(width).transpose();
+   }
+   vars.clear();
+}
+
+// number of outputs of f, from one value-only evaluation
+template <typename Scalar, typename F>
+int output_size(F& f, const Eigen::Matrix<Scalar, Dynamic, 1>& x) {
+   std::vector< ADValue<1, Scalar> > values;
+   values.reserve(x.size());
+   for (int i = 0; i < x.size(); ++i) values.emplace_back(x(i), 1);
+   return int(f(values).size());
+}
+
+
+// m x n Jacobian of the vector function f at x;
+// f returns a std::vector (or anything indexable with size()) of AD
+template <int K, typename Scalar, typename F>
+Eigen::Matrix<Scalar, Dynamic, Dynamic> chunked_jacobian(F f, const Eigen::Matrix<Scalar, Dynamic, 1>& x,
+                                                         int chunk = K) {
+
+   static_assert(K == Dynamic || K > 0, "chunk size must be positive");
+   eigen_assert(chunk > 0);
+
+   const int n = int(x.size());
+   const int m = output_size(f, x);
+
+   Eigen::Matrix<Scalar, Dynamic, Dynamic> jacobian(m, n);
+
+   ADArena arena;
+   std::vector< ADChunkVariable<K, Scalar> > vars;
+   vars.reserve(n);
+
+   for (int first = 0; first < n; first += chunk) {
+      const int width = std::min(chunk, n - first);
+      ADArenaScope scope(arena);
+      chunk_jacobian_pass<K>(f, x, vars, chunk, first, width, jacobian);
+   }
+   return jacobian;
+}
+
+
+#endif
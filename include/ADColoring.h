@@ -0,0 +1,292 @@
+#ifndef AD_COLORING_H
+#define AD_COLORING_H
+
+#include <vector>
+
+#include "ADPattern.h"
+#include "ADHvp.h"
+#include "ADReverse.h"
+
+
+// Compressed sparse Jacobians (Curtis, Powell and Reid).
+//
+// Two columns of J that have no nonzero in a common row can share one
+// seed direction: seeding input j with e_color(j) gives the compressed
+// Jacobian B = J S (m x p), and every nonzero J(r, j) can be read back
+// as B(r, color(j)).  The number of colors p needed by a greedy
+// distance-2 coloring of the columns depends on the stencil, not on n:
+// 3 for a 1D three point stencil and 7 for a 2D five point stencil in
+// natural order (the optimum there is 5), instead of one seed per
+// input.
+
+
+// color[j] of column j, colors in [0, colors)
+struct ADColoring {
+   std::vector<int> color;
+   int colors = 0;
+};
+
+
+// greedy distance-2 column coloring of the pattern J
+inline ADColoring column_coloring(const ADSparsity& J) {
+
+   // column -> rows (CSC) of the pattern
+   std::vector<int> col_ptr(J.cols + 1, 0);
+   for (int c : J.col_idx) ++col_ptr[c + 1];
+   for (int j = 0; j < J.cols; ++j) col_ptr[j + 1] += col_ptr[j];
+   std::vector<int> row_idx(J.col_idx.size());
+   std::vector<int> fill(col_ptr.begin(), col_ptr.end() - 1);
+   for (int r = 0; r < J.rows; ++r) {
+      for (int k = J.row_ptr[r]; k < J.row_ptr[r + 1]; ++k) row_idx[fill[J.col_idx[k]]++] = r;
+   }
+
+   ADColoring result;
+   result.color.assign(J.cols, -1);
+   // forbidden[c] == j marks color c as taken by a neighbour of column j
+   std::vector<int> forbidden;
+
+   for (int j = 0; j < J.cols; ++j) {
+      for (int k = col_ptr[j]; k < col_ptr[j + 1]; ++k) {
+         const int r = row_idx[k];
+         for (int l = J.row_ptr[r]; l < J.row_ptr[r + 1]; ++l) {
+            const int c = result.color[J.col_idx[l]];
+            if (c >= 0) forbidden[c] = j;
+         }
+      }
+      int c = 0;
+      while (c < result.colors && forbidden[c] == j) ++c;
+      if (c == result.colors) {
+         ++result.colors;
+         forbidden.push_back(-1);
+      }
+      result.color[j] = c;
+   }
+   return result;
+}
+
+
+// Jacobian of the vector function f at x on the given pattern and
+// coloring: one forward pass with p = coloring.colors derivative
+// components, decompressed into a CSR (row major) sparse matrix.
+// Keep pattern and coloring across Newton steps while the structure
+// does not change.
+template <typename Scalar, typename F>
+Eigen::SparseMatrix<Scalar, Eigen::RowMajor> sparse_jacobian(F f, const Eigen::Matrix<Scalar, Dynamic, 1>& x,
+                                                             const ADSparsity& pattern,
+                                                             const ADColoring& coloring) {
+
+   const int n = int(x.size());
+   const int p = std::max(coloring.colors, 1);
+   eigen_assert(pattern.cols == n);
+
+   Eigen::SparseMatrix<Scalar, Eigen::RowMajor> J(pattern.rows, n);
+   J.resizeNonZeros(pattern.nonZeros());
+   std::copy(pattern.row_ptr.begin(), pattern.row_ptr.end(), J.outerIndexPtr());
+   std::copy(pattern.col_idx.begin(), pattern.col_idx.end(), J.innerIndexPtr());
+
+   ADArena arena;
+   ADArenaScope scope(arena);
+
+   std::vector< ADGradient<Dynamic, Scalar> > vars;
+   vars.reserve(n);
+   for (int i = 0; i < n; ++i) vars.emplace_back(x(i), p, coloring.color[i]);
+
+   const auto result = f(vars);
+   eigen_assert(int(result.size()) == pattern.rows);
+
+   Scalar* values = J.valuePtr();
+   for (int r = 0; r < pattern.rows; ++r) {
+      const ADGradient<Dynamic, Scalar> row(result[r]);
+      for (int k = pattern.row_ptr[r]; k < pattern.row_ptr[r + 1]; ++k) {
+         values[k] = row.grad(coloring.color[pattern.col_idx[k]]);
+      }
+   }
+   return J;
+}
+
+// the same, finding the pattern (at x) and the coloring first
+template <typename Scalar, typename F>
+Eigen::SparseMatrix<Scalar, Eigen::RowMajor> sparse_jacobian(F f, const Eigen::Matrix<Scalar, Dynamic, 1>& x) {
+   const ADSparsity pattern = jacobian_sparsity(f, x);
+   return sparse_jacobian(f, x, pattern, column_coloring(pattern));
+}
+
+
+
+// Compressed sparse Hessians (star coloring, direct recovery).
+//
+// H is symmetric, so a coloring of its adjacency graph (i ~ j when
+// H(i, j) != 0, i != j) can be cheaper than coloring its columns.  A
+// star coloring is a distance-1 coloring in which every path on four
+// vertices uses at least three colors (Gebremedhin, Manne and Pothen,
+// SIAM Review 47, 2005).  Then for every nonzero H(i, j) at least one
+// of i, j has no other neighbour of the other's color, and with the
+// compressed Hessian B = H S
+//
+//    H(i, j) = B(i, color(j))   if j is the only neighbour of i of its color
+//            = B(j, color(i))   otherwise
+//    H(i, i) = B(i, color(i))
+//
+// B is evaluated as Hessian-vector products with ADHvp (the same local
+// partials as AD), K colors per pass.  The n inputs carry only their K
+// directional derivatives (ADHvp::input) and the intermediates at most
+// n x K entries, freed as soon as they die, so memory is O(n K) plus
+// what f itself keeps alive, never the dense n x n Hessian.
+
+
+// greedy star coloring of the adjacency graph of the pattern H
+inline ADColoring star_coloring(const ADSparsity& H) {
+
+   const int n = H.rows;
+   ADColoring result;
+   result.color.assign(n, -1);
+   std::vector<int> forbidden;
+
+   auto forbid = [&](int c, int v) { if (c >= 0) forbidden[c] = v; };
+
+   for (int v = 0; v < n; ++v) {
+      for (int k = H.row_ptr[v]; k < H.row_ptr[v + 1]; ++k) {
+         const int w = H.col_idx[k];
+         if (w == v) continue;
+         const int cw = result.color[w];
+         forbid(cw, v);
+         for (int l = H.row_ptr[w]; l < H.row_ptr[w + 1]; ++l) {
+            const int x = H.col_idx[l];
+            if (x == v || x == w) continue;
+            const int cx = result.color[x];
+            if (cx < 0) continue;
+            if (cw < 0) {
+               // v - w - x with w uncolored: v must differ from x
+               forbid(cx, v);
+               continue;
+            }
+            // x - w already starts a two colored path x - w - y?
+            for (int m = H.row_ptr[x]; m < H.row_ptr[x + 1]; ++m) {
+               const int y = H.col_idx[m];
+               if (y != w && y != x && result.color[y] == cw) {
+                  forbid(cx, v);
+                  break;
+               }
+            }
+         }
+      }
+      int c = 0;
+      while (c < result.colors && forbidden[c] == v) ++c;
+      if (c == result.colors) {
+         ++result.colors;
+         forbidden.push_back(-1);
+      }
+      result.color[v] = c;
+   }
+   return result;
+}
+
+
+// the sparse Hessian on the pattern from its compressed form B = H S
+// (n x colors) under a star coloring, by direct recovery
+template <typename Scalar>
+Eigen::SparseMatrix<Scalar, Eigen::RowMajor> star_recovery(const ADSparsity& pattern,
+                                                           const ADColoring& coloring,
+                                                           const Eigen::Matrix<Scalar, Dynamic, Dynamic>& B) {
+
+   const int n = pattern.rows;
+   const int p = coloring.colors;
+
+   Eigen::SparseMatrix<Scalar, Eigen::RowMajor> H(n, n);
+   H.resizeNonZeros(pattern.nonZeros());
+   std::copy(pattern.row_ptr.begin(), pattern.row_ptr.end(), H.outerIndexPtr());
+   std::copy(pattern.col_idx.begin(), pattern.col_idx.end(), H.innerIndexPtr());
+
+   // count[c] = neighbours of row i with color c
+   std::vector<int> count(p, 0);
+   Scalar* values = H.valuePtr();
+   for (int i = 0; i < n; ++i) {
+      for (int k = pattern.row_ptr[i]; k < pattern.row_ptr[i + 1]; ++k) {
+         ++count[coloring.color[pattern.col_idx[k]]];
+      }
+      for (int k = pattern.row_ptr[i]; k < pattern.row_ptr[i + 1]; ++k) {
+         const int j = pattern.col_idx[k];
+         const int cj = coloring.color[j];
+         values[k] = (j == i || count[cj] == 1) ? B(i, cj) : B(j, coloring.color[i]);
+      }
+      for (int k = pattern.row_ptr[i]; k < pattern.row_ptr[i + 1]; ++k) {
+         --count[coloring.color[pattern.col_idx[k]]];
+      }
+   }
+   return H;
+}
+
+
+// Hessian of the scalar function f at x on the given (symmetric, both
+// triangles) pattern and star coloring, as a CSR sparse matrix.
+// K colors are carried per forward pass.
+template <int K = 4, typename Scalar, typename F>
+Eigen::SparseMatrix<Scalar, Eigen::RowMajor> sparse_hessian(F f, const Eigen::Matrix<Scalar, Dynamic, 1>& x,
+                                                            const ADSparsity& pattern,
+                                                            const ADColoring& coloring) {
+
+   typedef ADHvp<Dynamic, K, Scalar> Variable;
+
+   const int n = int(x.size());
+   const int p = coloring.colors;
+   eigen_assert(pattern.rows == n && pattern.cols == n);
+
+   // compressed Hessian B = H S, n x p
+   Eigen::Matrix<Scalar, Dynamic, Dynamic> B(n, p);
+   Eigen::Matrix<Scalar, Dynamic, K> S(n, K);
+
+   std::vector<Variable> vars;
+   vars.reserve(n);
+
+   for (int first = 0; first < p; first += K) {
+      const int width = std::min(K, p - first);
+      S.setZero();
+      for (int i = 0; i < n; ++i) {
+         const int c = coloring.color[i] - first;
+         if (c >= 0 && c < width) S(i, c) = Scalar(1);
+      }
+      for (int i = 0; i < n; ++i) vars.push_back(Variable::input(x(i), n, i, S.row(i)));
+      const Variable result(f(vars));
+      // f may return one of the inputs, whose H V is zero and not stored
+      if (result.hv.rows() == n) B.middleCols(first, width) = result.hv.leftCols(width);
+      else B.middleCols(first, width).setZero();
+      vars.clear();
+   }
+
+   return star_recovery(pattern, coloring, B);
+}
+
+// the same, finding the pattern (at x) and the star coloring first
+template <int K = 4, typename Scalar, typename F>
+Eigen::SparseMatrix<Scalar, Eigen::RowMajor> sparse_hessian(F f, const Eigen::Matrix<Scalar, Dynamic, 1>& x) {
+   const ADSparsity pattern = hessian_sparsity(f, x);
+   return sparse_hessian<K>(f, x, pattern, star_coloring(pattern));
+}
+
+
+// The same by forward over reverse (ADReverse.h): f is recorded once
+// and all colors are one pair of tangent sweeps over the tape, so the
+// cost is O(colors * cost of f) whatever n is.
+template <typename Scalar, typename F>
+Eigen::SparseMatrix<Scalar, Eigen::RowMajor> reverse_sparse_hessian(F f, const Eigen::Matrix<Scalar, Dynamic, 1>& x,
+                                                                    const ADSparsity& pattern,
+                                                                    const ADColoring& coloring,
+                                                                    ADHessianTape<Scalar>& tape) {
+   const int n = int(x.size());
+   eigen_assert(pattern.rows == n && pattern.cols == n);
+
+   Eigen::Matrix<Scalar, Dynamic, Dynamic> S = Eigen::Matrix<Scalar, Dynamic, Dynamic>::Zero(n, coloring.colors);
+   for (int i = 0; i < n; ++i) S(i, coloring.color[i]) = Scalar(1);
+
+   return star_recovery(pattern, coloring, reverse_hessian_product(f, x, S, tape));
+}
+
+template <typename Scalar, typename F>
+Eigen::SparseMatrix<Scalar, Eigen::RowMajor> reverse_sparse_hessian(F f, const Eigen::Matrix<Scalar, Dynamic, 1>& x) {
+   const ADSparsity pattern = hessian_sparsity(f, x);
+   ADHessianTape<Scalar> tape;
+   return reverse_sparse_hessian(f, x, pattern, star_coloring(pattern), tape);
+}
+
+
+#endif
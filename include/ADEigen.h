@@ -0,0 +1,80 @@
+#ifndef AD_EIGEN_H
+#define AD_EIGEN_H
+
+#include "AutomaticDifferentiation.h"
+
+
+// AD as the scalar type of Eigen matrices.
+//
+//    typedef AD<> T;
+//    Eigen::Matrix<T, Dynamic, Dynamic> A(n, n);
+//    Eigen::Matrix<T, Dynamic, 1> b(n);
+//    ...                                       // fill with AD variables
+//    T d = b.dot(A*b);                         // products, reductions
+//    Eigen::Matrix<T, Dynamic, 1> x = A.lu().solve(b);
+//
+// Eigen default constructs and zero fills its matrices; for AD<> those
+// are constants with space_dim 0 (no derivative storage, see
+// ADExpression.h), so only entries that depend on variables carry a
+// gradient and Hessian.  Comparisons (for pivoting) use the values.
+//
+// Each scalar operation inside Eigen is a full AD operation, so the
+// costs below are per entry of the gradient and packed Hessian
+// (bench/EigenBench.cpp compares against hand written loops).  For
+// x = A^-1 b, linear_solve (ADLinearSolve.h) factors the values once.
+
+namespace Eigen {
+
+template <int N, int Order, typename V, typename G, typename H>
+struct NumTraits< AD<N, Order, V, G, H> > : NumTraits<V> {
+
+   typedef AD<N, Order, V, G, H> Real;
+   typedef AD<N, Order, V, G, H> NonInteger;
+   typedef AD<N, Order, V, G, H> Nested;
+   typedef V Literal;
+
+   // rough costs: a dense 8-entry gradient and packed Hessian
+   static constexpr int Derivatives = (Order >= 1 ? (N == Dynamic ? 8 : N) : 0)
+                                    + (Order >= 2 ? (N == Dynamic ? 36 : N*(N + 1)/2) : 0);
+
+   enum {
+      IsComplex = 0,
+      IsInteger = 0,
+      IsSigned = 1,
+      RequireInitialization = 1,
+      ReadCost = 1 + Derivatives,
+      AddCost = 1 + Derivatives,
+      MulCost = 1 + 3*Derivatives
+   };
+
+};
+
+// AD op Literal inside Eigen expressions (e.g. A*2.0f) stays AD
+template <int N, int Order, typename V, typename G, typename H, typename BinaryOp>
+struct ScalarBinaryOpTraits< AD<N, Order, V, G, H>, V, BinaryOp > {
+   typedef AD<N, Order, V, G, H> ReturnType;
+};
+
+template <int N, int Order, typename V, typename G, typename H, typename BinaryOp>
+struct ScalarBinaryOpTraits< V, AD<N, Order, V, G, H>, BinaryOp > {
+   typedef AD<N, Order, V, G, H> ReturnType;
+};
+
+} // namespace Eigen
+
+
+// Functions Eigen looks up by ADL for a real scalar type
+template <int N, int Order, typename V, typename G, typename H>
+const AD<N, Order, V, G, H>& conj(const AD<N, Order, V, G, H>& x) { return x; }
+
+template <int N, int Order, typename V, typename G, typename H>
+const AD<N, Order, V, G, H>& real(const AD<N, Order, V, G, H>& x) { return x; }
+
+template <int N, int Order, typename V, typename G, typename H>
+AD<N, Order, V, G, H> imag(const AD<N, Order, V, G, H>&) { return AD<N, Order, V, G, H>(); }
+
+template <int N, int Order, typename V, typename G, typename H>
+AD<N, Order, V, G, H> abs2(const AD<N, Order, V, G, H>& x) { return x*x; }
+
+
+#endif
@@ -0,0 +1,435 @@
+#ifndef AD_EXPRESSION_H
+#define AD_EXPRESSION_H
+
+#include <algorithm>
+#include <type_traits>
+
+#include "GetEigen.h"
+#include "ADStats.h"
+
+
+// Expression templates for AD<N> (included from AutomaticDifferentiation.h).
+//
+// a*b + c/d - e does not build an AD for every sub-expression.
+// Each operator returns a small node that holds references to its
+// operands (or copies of nested nodes), its value, and the local
+// partial derivatives of the operation.  Gradient and Hessian are
+// computed in one pass when the node is assigned to an AD.
+//
+// Every node (and AD itself) provides
+//
+//    value, space_dim                       public members, like AD
+//    accumulate(wg, g, wh, H)               g += wg*grad,  H += wh*hess
+//    references(p)                          true if the AD at p is an operand
+//
+// Linear nodes (+, -, scaling) just forward the weights to their
+// operands, so a chain of sums and scalings writes straight into the
+// result.  Nonlinear nodes need the gradients of their operands for
+// the rank-1/rank-2 Hessian terms. For an AD operand that is its grad
+// member; for a nested node it is evaluated into a temporary.
+//
+// For first order types (Result::order == 1) every node is linear in
+// the gradient, so nodes only forward weights and never need operand
+// gradients or temporaries; order 0 types skip accumulate entirely.
+//
+// Each node has a Result: the AD type it evaluates to.  Operands of
+// different scalar types promote like the built-in arithmetic types
+// (see ADPromote below); values are converted into the scalar type of
+// the gradient/Hessian they are added to.
+//
+// An AD<> with space_dim 0 is a constant (AD<>(c), or the Scalar(0)
+// Eigen fills matrices with): it has no derivative storage and mixes
+// with any design space size, so a node takes the larger space_dim of
+// its operands and skips constant ones.  For AD<N> this is a compile
+// time no-op.
+//
+// As with Eigen, do not hold a node in an `auto` variable past the end of
+// the statement: it refers to its operands.
+
+
+template <int N, int Order, typename V, typename G, typename H> class AD;
+
+
+// Placeholder for a derivative an AD type does not track
+// (the Hessian of AD<N, 1>, the gradient and Hessian of AD<N, 0>).
+struct NoDerivative {
+   void setZero(int) {}
+};
+
+inline std::ostream& operator<<(std::ostream& os, const NoDerivative&) {
+   return os << "(not tracked)";
+}
+
+
+template <typename Derived>
+struct ADExpr {
+   const Derived& derived() const { return static_cast<const Derived&>(*this); }
+};
+
+
+// AD leaves are held by reference, nested nodes by value
+template <typename T>
+struct ADExprStorage { typedef const T Type; };
+
+template <int N, int Order, typename V, typename G, typename H>
+struct ADExprStorage< AD<N, Order, V, G, H> > { typedef const AD<N, Order, V, G, H>& Type; };
+
+template <typename T>
+struct is_ad_leaf : std::false_type {};
+
+template <int N, int Order, typename V, typename G, typename H>
+struct is_ad_leaf< AD<N, Order, V, G, H> > : std::true_type {};
+
+
+// Result type of a binary operation on two AD types: the same design
+// space, the lower derivative order, and each scalar type promoted as
+// float op double -> double.
+template <typename A, typename B>
+struct ADPromote;
+
+template <int NA, int OA, typename VA, typename GA, typename HA,
+          int NB, int OB, typename VB, typename GB, typename HB>
+struct ADPromote< AD<NA, OA, VA, GA, HA>, AD<NB, OB, VB, GB, HB> > {
+   static_assert(NA == NB, "AD operands must share a design space");
+   typedef AD<NA, (OA < OB ? OA : OB),
+              typename std::common_type<VA, VB>::type,
+              typename std::common_type<GA, GB>::type,
+              typename std::common_type<HA, HB>::type> type;
+};
+
+// AD op U (and U op AD) for an arithmetic type U
+template <typename A, typename U>
+struct ADPromoteScalar;
+
+template <int N, int Order, typename V, typename G, typename H, typename U>
+struct ADPromoteScalar< AD<N, Order, V, G, H>, U > {
+   typedef AD<N, Order,
+              typename std::common_type<V, U>::type,
+              typename std::common_type<G, U>::type,
+              typename std::common_type<H, U>::type> type;
+};
+
+template <typename U>
+using if_arithmetic = typename std::enable_if<std::is_arithmetic<U>::value, int>::type;
+
+
+// derivative order actually produced when accumulating into (g, H):
+// a target without a Hessian (or gradient) caps it
+template <typename Result, typename Gradient, typename Hessian>
+constexpr int accumulate_order() {
+   return std::is_same<Gradient, NoDerivative>::value ? 0
+        : std::is_same<Hessian, NoDerivative>::value ? std::min(Result::order, 1)
+        : Result::order;
+}
+
+
+// y += w*x, converting x to the scalar type of y
+// (cast<> to the same scalar type is a no-op in Eigen)
+template <typename Y, typename X, typename W>
+void add_scaled(Y& y, const X& x, W w) {
+   typedef typename Y::Scalar Scalar;
+   y += x.template cast<Scalar>()*Scalar(w);
+}
+
+
+// Gradient of an operand, for the rank updates of a nonlinear node.
+// Adds wh * (Hessian of e) to H on the way.  A nested node is
+// evaluated into a temporary of the caller's Gradient type.
+template <typename Gradient, typename E, typename Hessian, typename W>
+decltype(auto) operand_gradient(const E& e, Hessian& H, W wh) {
+   if constexpr (is_ad_leaf<E>::value) {
+      if (wh != W(0)) add_scaled(H.data, e.hess.data, wh);
+      return (e.grad);
+   }
+   else {
+      Gradient g;
+      g.setZero(e.space_dim);
+      e.accumulate(W(1), g, wh, H);
+      return g;
+   }
+}
+
+
+// true for a run time sized operand without derivatives (see above)
+template <typename E>
+bool ad_constant(const E& e) {
+   return E::Result::dimension == Dynamic && e.space_dim == 0;
+}
+
+
+// f(e) with f' = d1 and f'' = d2 at the value of e, added to (g, H)
+// for a node of type Result:
+//    grad = d1*grad(e)
+//    hess = d1*hess(e) + d2*grad(e)*grad(e)^T
+template <typename Result, typename E, typename Value, typename W, typename Gradient, typename Hessian>
+void accumulate_unary(const E& e, Value d1, Value d2, W wg, Gradient& g, W wh, Hessian& H) {
+   if (ad_constant(e)) return;
+   constexpr int order = accumulate_order<Result, Gradient, Hessian>();
+   if constexpr (order == 1) {
+      e.accumulate(wg*d1, g, wh*d1, H);
+   }
+   else if constexpr (order == 2) {
+      if (d2 == Value(0)) {
+         e.accumulate(wg*d1, g, wh*d1, H);
+         return;
+      }
+      decltype(auto) ge = operand_gradient<Gradient>(e, H, wh*d1);
+      add_scaled(g, ge, wg*d1);
+      if (wh != W(0)) H.rankUpdate(ge, wh*d2);
+   }
+}
+
+
+// f(e), see accumulate_unary
+template <typename E, typename R = typename E::Result>
+class ADUnaryExpr : public ADExpr< ADUnaryExpr<E, R> > {
+
+   public:
+
+   typedef R Result;
+   typedef typename Result::Value Value;
+
+   typename ADExprStorage<E>::Type operand;
+
+   Value value;
+   int space_dim;
+
+   Value d1, d2;
+
+   ADUnaryExpr(const E& e, Value val, Value d1, Value d2)
+      : operand(e), value(val), space_dim(e.space_dim), d1(d1), d2(d2) {}
+
+   bool references(const void* p) const { return operand.references(p); }
+
+   template <typename W, typename Gradient, typename Hessian>
+   void accumulate(W wg, Gradient& g, W wh, Hessian& H) const {
+      accumulate_unary<Result>(operand, d1, d2, wg, g, wh, H);
+   }
+
+};
+
+
+// f(l, r) with first partials dl, dr and second partials dll, dlr, drr:
+//    grad = dl*grad(l) + dr*grad(r)
+//    hess = dl*hess(l) + dr*hess(r)
+//         + dll*grad(l)grad(l)^T
+//         + dlr*(grad(l)grad(r)^T + grad(r)grad(l)^T)
+//         + drr*grad(r)grad(r)^T
+// The last two lines are folded into one symmetric rank-2 update
+// with u = dlr*grad(l) + drr/2*grad(r) and v = grad(r).  With a
+// constant operand this is f as a function of the other one.
+template <typename L, typename R>
+class ADBinaryExpr : public ADExpr< ADBinaryExpr<L, R> > {
+
+   public:
+
+   typedef typename ADPromote<typename L::Result, typename R::Result>::type Result;
+   typedef typename Result::Value Value;
+
+   typename ADExprStorage<L>::Type left;
+   typename ADExprStorage<R>::Type right;
+
+   Value value;
+   int space_dim;
+
+   Value dl, dr;
+   Value dll, dlr, drr;
+
+   ADBinaryExpr(const L& l, const R& r, Value val,
+                Value dl, Value dr,
+                Value dll = 0, Value dlr = 0, Value drr = 0)
+      : left(l), right(r), value(val), space_dim(std::max(l.space_dim, r.space_dim)),
+        dl(dl), dr(dr), dll(dll), dlr(dlr), drr(drr) {
+      eigen_assert(l.space_dim == r.space_dim || ad_constant(l) || ad_constant(r));
+   }
+
+   bool references(const void* p) const {
+      return left.references(p) || right.references(p);
+   }
+
+   template <typename W, typename Gradient, typename Hessian>
+   void accumulate(W wg, Gradient& g, W wh, Hessian& H) const {
+      if (ad_constant(left)) return accumulate_unary<Result>(right, dr, drr, wg, g, wh, H);
+      if (ad_constant(right)) return accumulate_unary<Result>(left, dl, dll, wg, g, wh, H);
+      constexpr int order = accumulate_order<Result, Gradient, Hessian>();
+      if constexpr (order == 1) {
+         left.accumulate(wg*dl, g, wh*dl, H);
+         right.accumulate(wg*dr, g, wh*dr, H);
+      }
+      else if constexpr (order == 2) {
+         if (dll == Value(0) && dlr == Value(0) && drr == Value(0)) {
+            left.accumulate(wg*dl, g, wh*dl, H);
+            right.accumulate(wg*dr, g, wh*dr, H);
+            return;
+         }
+         decltype(auto) gl = operand_gradient<Gradient>(left, H, wh*dl);
+         decltype(auto) gr = operand_gradient<Gradient>(right, H, wh*dr);
+         add_scaled(g, gl, wg*dl);
+         add_scaled(g, gr, wg*dr);
+         if (wh == W(0)) return;
+         typedef typename Hessian::Storage::Scalar HS;
+         if (dll != Value(0)) H.rankUpdate(gl, HS(wh*dll));
+         H.rankUpdate(gl.template cast<HS>()*HS(dlr) + gr.template cast<HS>()*HS(Value(0.5)*drr),
+                      gr, HS(wh));
+      }
+   }
+
+};
+
+
+
+//-------------------------
+// unary operations
+template <typename E>
+ADUnaryExpr<E> operator-(const ADExpr<E>& e) {
+   typedef typename E::Result::Value Value;
+   const E& x = e.derived();
+   ad_stats::operation<typename E::Result>(ad_stats::neg, x.space_dim);
+   return ADUnaryExpr<E>(x, -x.value, Value(-1), Value(0));
+}
+
+//-------------------------
+// binary operations
+template <typename L, typename R>
+ADBinaryExpr<L, R> operator+(const ADExpr<L>& l, const ADExpr<R>& r) {
+   typedef typename ADBinaryExpr<L, R>::Value Value;
+   const L& a = l.derived();
+   const R& b = r.derived();
+   ad_stats::operation<typename ADBinaryExpr<L, R>::Result>(ad_stats::add, a.space_dim);
+   return ADBinaryExpr<L, R>(a, b, Value(a.value) + Value(b.value), Value(1), Value(1));
+}
+
+template <typename L, typename R>
+ADBinaryExpr<L, R> operator-(const ADExpr<L>& l, const ADExpr<R>& r) {
+   typedef typename ADBinaryExpr<L, R>::Value Value;
+   const L& a = l.derived();
+   const R& b = r.derived();
+   ad_stats::operation<typename ADBinaryExpr<L, R>::Result>(ad_stats::sub, a.space_dim);
+   return ADBinaryExpr<L, R>(a, b, Value(a.value) - Value(b.value), Value(1), Value(-1));
+}
+
+template <typename L, typename R>
+ADBinaryExpr<L, R> operator*(const ADExpr<L>& l, const ADExpr<R>& r) {
+   typedef typename ADBinaryExpr<L, R>::Value Value;
+   const L& a = l.derived();
+   const R& b = r.derived();
+   ad_stats::operation<typename ADBinaryExpr<L, R>::Result>(ad_stats::mul, a.space_dim);
+   return ADBinaryExpr<L, R>(a, b, Value(a.value) * Value(b.value),
+                             Value(b.value), Value(a.value),
+                             Value(0), Value(1), Value(0));
+}
+
+// with q = u/v:
+//    dq/du = 1/v,  dq/dv = -q/v
+//    d2q/dudv = -1/v^2,  d2q/dv2 = 2q/v^2
+template <typename L, typename R>
+ADBinaryExpr<L, R> operator/(const ADExpr<L>& l, const ADExpr<R>& r) {
+   typedef typename ADBinaryExpr<L, R>::Value Value;
+   const L& a = l.derived();
+   const R& b = r.derived();
+   ad_stats::operation<typename ADBinaryExpr<L, R>::Result>(ad_stats::div, a.space_dim);
+   Value inv = Value(1) / Value(b.value);
+   Value q = Value(a.value) * inv;
+   return ADBinaryExpr<L, R>(a, b, q,
+                             inv, -q*inv,
+                             Value(0), -inv*inv, Value(2)*q*inv*inv);
+}
+
+//----------------------------------------------------------------------
+// left var is AD, right var is a number (any arithmetic type U;
+// the result promotes, e.g. AD<N, 2, float> * double -> double)
+template <typename E, typename U>
+using ADScalarExpr = ADUnaryExpr<E, typename ADPromoteScalar<typename E::Result, U>::type>;
+
+template <typename E, typename U, if_arithmetic<U> = 0>
+ADScalarExpr<E, U> operator+(const ADExpr<E>& e, U other) {
+   typedef typename ADScalarExpr<E, U>::Value Value;
+   const E& x = e.derived();
+   ad_stats::operation<typename ADScalarExpr<E, U>::Result>(ad_stats::scalar, x.space_dim);
+   return ADScalarExpr<E, U>(x, Value(x.value) + Value(other), Value(1), Value(0));
+}
+
+template <typename E, typename U, if_arithmetic<U> = 0>
+ADScalarExpr<E, U> operator-(const ADExpr<E>& e, U other) {
+   typedef typename ADScalarExpr<E, U>::Value Value;
+   const E& x = e.derived();
+   ad_stats::operation<typename ADScalarExpr<E, U>::Result>(ad_stats::scalar, x.space_dim);
+   return ADScalarExpr<E, U>(x, Value(x.value) - Value(other), Value(1), Value(0));
+}
+
+template <typename E, typename U, if_arithmetic<U> = 0>
+ADScalarExpr<E, U> operator*(const ADExpr<E>& e, U other) {
+   typedef typename ADScalarExpr<E, U>::Value Value;
+   const E& x = e.derived();
+   ad_stats::operation<typename ADScalarExpr<E, U>::Result>(ad_stats::scalar, x.space_dim);
+   return ADScalarExpr<E, U>(x, Value(x.value) * Value(other), Value(other), Value(0));
+}
+
+template <typename E, typename U, if_arithmetic<U> = 0>
+ADScalarExpr<E, U> operator/(const ADExpr<E>& e, U other) {
+   typedef typename ADScalarExpr<E, U>::Value Value;
+   const E& x = e.derived();
+   ad_stats::operation<typename ADScalarExpr<E, U>::Result>(ad_stats::scalar, x.space_dim);
+   Value inv = Value(1) / Value(other);
+   return ADScalarExpr<E, U>(x, Value(x.value) * inv, inv, Value(0));
+}
+
+//-------------------------
+// r-operations
+template <typename E, typename U, if_arithmetic<U> = 0>
+ADScalarExpr<E, U> operator+(U self, const ADExpr<E>& e) {
+   return e + self;
+}
+
+template <typename E, typename U, if_arithmetic<U> = 0>
+ADScalarExpr<E, U> operator-(U self, const ADExpr<E>& e) {
+   typedef typename ADScalarExpr<E, U>::Value Value;
+   const E& x = e.derived();
+   ad_stats::operation<typename ADScalarExpr<E, U>::Result>(ad_stats::scalar, x.space_dim);
+   return ADScalarExpr<E, U>(x, Value(self) - Value(x.value), Value(-1), Value(0));
+}
+
+template <typename E, typename U, if_arithmetic<U> = 0>
+ADScalarExpr<E, U> operator*(U self, const ADExpr<E>& e) {
+   return e * self;
+}
+
+// c/v:  d/dv = -c/v^2,  d2/dv2 = 2c/v^3
+template <typename E, typename U, if_arithmetic<U> = 0>
+ADScalarExpr<E, U> operator/(U self, const ADExpr<E>& e) {
+   typedef typename ADScalarExpr<E, U>::Value Value;
+   const E& x = e.derived();
+   ad_stats::operation<typename ADScalarExpr<E, U>::Result>(ad_stats::scalar_div, x.space_dim);
+   Value inv = Value(1) / Value(x.value);
+   Value q = Value(self) * inv;
+   return ADScalarExpr<E, U>(x, q, -q*inv, Value(2)*q*inv*inv);
+}
+
+
+//-------------------------
+// comparisons, on the values
+#define AD_COMPARISON(op)                                              \
+template <typename L, typename R>                                      \
+bool operator op(const ADExpr<L>& l, const ADExpr<R>& r) {             \
+   return l.derived().value op r.derived().value;                      \
+}                                                                      \
+template <typename E, typename U, if_arithmetic<U> = 0>                \
+bool operator op(const ADExpr<E>& e, U other) {                        \
+   return e.derived().value op other;                                  \
+}                                                                      \
+template <typename E, typename U, if_arithmetic<U> = 0>                \
+bool operator op(U self, const ADExpr<E>& e) {                         \
+   return self op e.derived().value;                                   \
+}
+
+AD_COMPARISON(==)
+AD_COMPARISON(!=)
+AD_COMPARISON(<)
+AD_COMPARISON(<=)
+AD_COMPARISON(>)
+AD_COMPARISON(>=)
+
+#undef AD_COMPARISON
+
+
+#endif
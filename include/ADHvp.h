@@ -0,0 +1,380 @@
+#ifndef AD_HVP_H
+#define AD_HVP_H
+
+#include <string>
+
+#include "AutomaticDifferentiation.h"
+
+
+// Hessian-vector products without the Hessian (forward over forward).
+//
+// For a fixed block of K seed directions V (n x K) every variable
+// carries
+//
+//    value
+//    grad    n         gradient
+//    dot     K         grad^T V, the directional derivatives
+//    hv      n x K     H V
+//
+// so each operation is O(n K) instead of the O(n^2) Hessian update of
+// AD.  With first partials dl, dr and second partials dll, dlr, drr of
+// an operation f(l, r):
+//
+//    grad = dl*grad(l) + dr*grad(r)
+//    dot  = dl*dot(l)  + dr*dot(r)
+//    hv   = dl*hv(l) + dr*hv(r)
+//         + grad(l) * (dll*dot(l) + dlr*dot(r))
+//         + grad(r) * (dlr*dot(l) + drr*dot(r))
+//
+// K = 1 is the single product H v for truncated Newton / CG; K > 1
+// gives H V for a small block of directions in one sweep.
+//
+// ADHvp<Dynamic, K>::input(...) builds an independent variable whose
+// gradient e_i and zero H V are implicit (grad and hv stay empty), so
+// seeding all n inputs costs O(n K) instead of O(n^2 K).  Only the
+// results of operations carry n-sized storage.
+template <int N = Dynamic, int K = 1, typename Scalar = Number>
+class ADHvp {
+
+   public:
+
+   typedef Scalar Value;
+   typedef typename ADVectorType<Scalar, N>::Type Gradient;
+   typedef Eigen::Matrix<Scalar, 1, K> Directional;
+   typedef Eigen::Matrix<Scalar, N, K> Product;
+
+   Value value;
+   Gradient grad;
+   Directional dot;
+   Product hv;
+
+   // number of design space dimensions
+   int space_dim;
+
+   // location in the gradient space
+   int index;
+
+   // AD variables can have a name
+   std::string name;
+
+
+   // constructor for base variable initilization:
+   // V is the n x K block of seed directions
+   template <typename Derived>
+   ADHvp(Value val, int space_size, int grad_index,
+         const Eigen::MatrixBase<Derived>& V, std::string name="ADvar"){
+      eigen_assert(N == Dynamic || space_size == N);
+      eigen_assert(V.rows() == space_size && V.cols() == K);
+      value = val;
+      space_dim = space_size;
+      index = grad_index;
+      this->name = name;
+
+      grad.setZero(space_size);
+      grad(index) = Scalar(1);
+      dot = V.row(index).template cast<Scalar>();
+      hv.setZero(space_size, K);
+   }
+
+
+   // independent variable i with directional derivatives dot = V.row(i)
+   // and, for N = Dynamic, an implicit unit gradient and zero H V
+   template <typename Derived>
+   static ADHvp input(Value val, int space_size, int grad_index,
+                      const Eigen::MatrixBase<Derived>& dot, std::string name="ADvar");
+
+
+   // constructor for operations
+   ADHvp(Value val, int space_size, std::string name="ADvar"){
+      eigen_assert(N == Dynamic || space_size == N);
+      value = val;
+      space_dim = space_size;
+      index = -1;
+      this->name = name;
+
+      grad.setZero(space_size);
+      dot.setZero();
+      hv.setZero(space_size, K);
+   }
+
+   // f(*this) from f, f' and f''
+   ADHvp unary(Value f, Value d1, Value d2) const;
+
+   // f(*this, other) from its first and second partials
+   ADHvp binary(const ADHvp& other, Value f, Value dl, Value dr,
+                Value dll, Value dlr, Value drr) const;
+
+   //-------------------------
+   // unary operations
+   ADHvp operator-() const;
+
+   //-------------------------
+   // binary operations
+   ADHvp operator+(const ADHvp& other) const;
+   ADHvp operator-(const ADHvp& other) const;
+   ADHvp operator*(const ADHvp& other) const;
+   ADHvp operator/(const ADHvp& other) const;
+
+   ADHvp operator+(Value other) const;
+   ADHvp operator-(Value other) const;
+   ADHvp operator*(Value other) const;
+   ADHvp operator/(Value other) const;
+
+   ADHvp& operator+=(const ADHvp& other) { return *this = *this + other; }
+   ADHvp& operator-=(const ADHvp& other) { return *this = *this - other; }
+   ADHvp& operator*=(const ADHvp& other) { return *this = *this * other; }
+   ADHvp& operator/=(const ADHvp& other) { return *this = *this / other; }
+
+   ADHvp& operator+=(Value other) { return *this = *this + other; }
+   ADHvp& operator-=(Value other) { return *this = *this - other; }
+   ADHvp& operator*=(Value other) { return *this = *this * other; }
+   ADHvp& operator/=(Value other) { return *this = *this / other; }
+
+   //-------------------------
+   // printing
+   void print() const;
+
+   private:
+
+   ADHvp() = default;
+
+   // an input from input(): grad = e_index and hv = 0, not stored
+   bool unit() const { return N == Dynamic && index >= 0 && grad.size() == 0; }
+
+   // g += w*grad,  h += w*hv,  h += grad*row
+   template <typename G> void add_grad(G& g, Value w) const;
+   template <typename P> void add_hv(P& h, Value w) const;
+   template <typename P, typename R> void add_outer(P& h, const R& row) const;
+
+};
+
+
+template <int N, int K, typename Scalar>
+template <typename Derived>
+ADHvp<N, K, Scalar> ADHvp<N, K, Scalar>::input(Value val, int space_size, int grad_index,
+                                               const Eigen::MatrixBase<Derived>& dot, std::string name) {
+   eigen_assert(N == Dynamic || space_size == N);
+   eigen_assert(dot.size() == K);
+   ADHvp x;
+   x.value = val;
+   x.space_dim = space_size;
+   x.index = grad_index;
+   x.name = name;
+   x.dot = dot.template cast<Scalar>();
+   if constexpr (N != Dynamic) {
+      x.grad.setZero();
+      x.grad(grad_index) = Scalar(1);
+      x.hv.setZero();
+   }
+   return x;
+}
+
+template <int N, int K, typename Scalar>
+template <typename G>
+void ADHvp<N, K, Scalar>::add_grad(G& g, Value w) const {
+   if (unit()) g(index) += w;
+   else g += grad*w;
+}
+
+template <int N, int K, typename Scalar>
+template <typename P>
+void ADHvp<N, K, Scalar>::add_hv(P& h, Value w) const {
+   if (!unit()) h += hv*w;
+}
+
+template <int N, int K, typename Scalar>
+template <typename P, typename R>
+void ADHvp<N, K, Scalar>::add_outer(P& h, const R& row) const {
+   if (unit()) h.row(index) += row;
+   else h.noalias() += grad*row;
+}
+
+
+
+template <int N, int K, typename Scalar>
+ADHvp<N, K, Scalar> ADHvp<N, K, Scalar>::unary(Value f, Value d1, Value d2) const {
+   ADHvp result(f, space_dim);
+   add_grad(result.grad, d1);
+   result.dot = dot*d1;
+   add_hv(result.hv, d1);
+   if (d2 != Value(0)) add_outer(result.hv, dot*d2);
+   return result;
+}
+
+template <int N, int K, typename Scalar>
+ADHvp<N, K, Scalar> ADHvp<N, K, Scalar>::binary(const ADHvp& other, Value f, Value dl, Value dr,
+                                                Value dll, Value dlr, Value drr) const {
+   ADHvp result(f, space_dim);
+   add_grad(result.grad, dl);
+   other.add_grad(result.grad, dr);
+   result.dot = dot*dl + other.dot*dr;
+   add_hv(result.hv, dl);
+   other.add_hv(result.hv, dr);
+   if (dll != Value(0) || dlr != Value(0)) add_outer(result.hv, dot*dll + other.dot*dlr);
+   if (dlr != Value(0) || drr != Value(0)) other.add_outer(result.hv, dot*dlr + other.dot*drr);
+   return result;
+}
+
+//-------------------------
+// unary operations
+template <int N, int K, typename Scalar>
+ADHvp<N, K, Scalar> ADHvp<N, K, Scalar>::operator-() const {
+   return unary(-value, Value(-1), Value(0));
+}
+
+//-------------------------
+// binary operations
+template <int N, int K, typename Scalar>
+ADHvp<N, K, Scalar> ADHvp<N, K, Scalar>::operator+(const ADHvp& other) const {
+   ADHvp result(value + other.value, space_dim);
+   add_grad(result.grad, Value(1));
+   other.add_grad(result.grad, Value(1));
+   result.dot = dot + other.dot;
+   add_hv(result.hv, Value(1));
+   other.add_hv(result.hv, Value(1));
+   return result;
+}
+
+template <int N, int K, typename Scalar>
+ADHvp<N, K, Scalar> ADHvp<N, K, Scalar>::operator-(const ADHvp& other) const {
+   ADHvp result(value - other.value, space_dim);
+   add_grad(result.grad, Value(1));
+   other.add_grad(result.grad, Value(-1));
+   result.dot = dot - other.dot;
+   add_hv(result.hv, Value(1));
+   other.add_hv(result.hv, Value(-1));
+   return result;
+}
+
+template <int N, int K, typename Scalar>
+ADHvp<N, K, Scalar> ADHvp<N, K, Scalar>::operator*(const ADHvp& other) const {
+   return binary(other, value*other.value, other.value, value,
+                 Value(0), Value(1), Value(0));
+}
+
+// same partials as AD: q = u/v,
+//    dq/du = 1/v,  dq/dv = -q/v,  d2q/dudv = -1/v^2,  d2q/dv2 = 2q/v^2
+template <int N, int K, typename Scalar>
+ADHvp<N, K, Scalar> ADHvp<N, K, Scalar>::operator/(const ADHvp& other) const {
+   const Value inv = Value(1) / other.value;
+   const Value q = value*inv;
+   return binary(other, q, inv, -q*inv,
+                 Value(0), -inv*inv, Value(2)*q*inv*inv);
+}
+
+//----------------------------------------------------------------------
+// left var is ADHvp, right var is a number
+template <int N, int K, typename Scalar>
+ADHvp<N, K, Scalar> ADHvp<N, K, Scalar>::operator+(Value other) const {
+   if (unit()) return unary(value + other, Value(1), Value(0));
+   ADHvp result(*this);
+   result.value += other;
+   result.index = -1;
+   return result;
+}
+
+template <int N, int K, typename Scalar>
+ADHvp<N, K, Scalar> ADHvp<N, K, Scalar>::operator-(Value other) const {
+   if (unit()) return unary(value - other, Value(1), Value(0));
+   ADHvp result(*this);
+   result.value -= other;
+   result.index = -1;
+   return result;
+}
+
+template <int N, int K, typename Scalar>
+ADHvp<N, K, Scalar> ADHvp<N, K, Scalar>::operator*(Value other) const {
+   return unary(value*other, other, Value(0));
+}
+
+template <int N, int K, typename Scalar>
+ADHvp<N, K, Scalar> ADHvp<N, K, Scalar>::operator/(Value other) const {
+   return (*this) * (Value(1) / other);
+}
+
+//-------------------------
+// printing
+template <int N, int K, typename Scalar>
+void ADHvp<N, K, Scalar>::print() const
+{
+   std::cout << "ADHvp(" << name << std::endl;
+   std::cout << " design space size: (" << space_dim << "), directions: " << K << std::endl;
+   std::cout << " value: " << value << "" << std::endl;
+   std::cout << " grad: \n" << grad << "" << std::endl;
+   std::cout << " H V: \n" << hv << "" << std::endl;
+   std::cout << "    )\n\n" << std::endl;
+}
+
+//-------------------------
+// r-operations (any arithmetic type, converted to Scalar)
+template <int N, int K, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADHvp<N, K, Scalar> operator+( U self , const ADHvp<N, K, Scalar>& other) {
+   return other + Scalar(self);
+}
+template <int N, int K, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADHvp<N, K, Scalar> operator-( U self , const ADHvp<N, K, Scalar>& other) {
+   return -other + Scalar(self);
+}
+template <int N, int K, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADHvp<N, K, Scalar> operator*( U self , const ADHvp<N, K, Scalar>& other) {
+   return other * Scalar(self);
+}
+// c/v:  d/dv = -c/v^2,  d2/dv2 = 2c/v^3
+template <int N, int K, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADHvp<N, K, Scalar> operator/( U self , const ADHvp<N, K, Scalar>& other) {
+   const Scalar inv = Scalar(1) / other.value;
+   const Scalar q = Scalar(self)*inv;
+   return other.unary(q, -q*inv, Scalar(2)*q*inv*inv);
+}
+
+//-------------------------
+// elementary functions, with the partials of ADMath.h
+#define AD_HVP_FUNCTION(name)                                          \
+template <int N, int K, typename Scalar>                               \
+ADHvp<N, K, Scalar> name(const ADHvp<N, K, Scalar>& x) {               \
+   const ADPartials<Scalar> p = ad_partials::name(x.value);            \
+   return x.unary(p.f, p.d1, p.d2);                                    \
+}
+
+AD_HVP_FUNCTION(exp)
+AD_HVP_FUNCTION(log)
+AD_HVP_FUNCTION(log10)
+AD_HVP_FUNCTION(sqrt)
+AD_HVP_FUNCTION(cbrt)
+AD_HVP_FUNCTION(sin)
+AD_HVP_FUNCTION(cos)
+AD_HVP_FUNCTION(tan)
+AD_HVP_FUNCTION(asin)
+AD_HVP_FUNCTION(acos)
+AD_HVP_FUNCTION(atan)
+AD_HVP_FUNCTION(sinh)
+AD_HVP_FUNCTION(cosh)
+AD_HVP_FUNCTION(tanh)
+AD_HVP_FUNCTION(abs)
+
+#undef AD_HVP_FUNCTION
+
+template <int N, int K, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADHvp<N, K, Scalar> pow(const ADHvp<N, K, Scalar>& x, U p) {
+   const ADPartials<Scalar> d = ad_partials::pow(x.value, p);
+   return x.unary(d.f, d.d1, d.d2);
+}
+
+// functions of two arguments
+#define AD_HVP_BINARY_FUNCTION(name, partials)                         \
+template <int N, int K, typename Scalar>                               \
+ADHvp<N, K, Scalar> name(const ADHvp<N, K, Scalar>& l,                 \
+                         const ADHvp<N, K, Scalar>& r) {               \
+   const ADBinaryPartials<Scalar> p =                                  \
+      ad_partials::partials(l.value, r.value);                         \
+   return l.binary(r, p.f, p.dl, p.dr, p.dll, p.dlr, p.drr);           \
+}
+
+AD_HVP_BINARY_FUNCTION(pow, binary_pow)
+AD_HVP_BINARY_FUNCTION(atan2, atan2)
+AD_HVP_BINARY_FUNCTION(hypot, hypot)
+
+#undef AD_HVP_BINARY_FUNCTION
+
+
+#endif
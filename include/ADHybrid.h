@@ -0,0 +1,605 @@
+#ifndef AD_HYBRID_H
+#define AD_HYBRID_H
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "AutomaticDifferentiation.h"
+
+
+// Global knobs for the hybrid sparse/dense derivative storage.
+struct HybridStorage {
+   // an array switches from index-compressed to dense storage once more
+   // than this fraction of its entries is nonzero
+   static inline double dense_fraction = 0.1;
+};
+
+
+// A flat array of `size` entries that stays index-compressed
+// (sorted indices + values) while it has few nonzeros and promotes
+// itself to a dense Eigen vector past HybridStorage::dense_fraction.
+// Promotion is one way: an array never goes back to sparse.
+//
+// ADHybrid uses one of these for the gradient (size n) and one for the
+// packed upper triangle of the Hessian (size n*(n+1)/2, same layout as
+// SymmetricMatrix).
+template <typename Scalar>
+class HybridArray {
+
+   public:
+
+   typedef Eigen::Index Index;
+   typedef Eigen::Matrix<Scalar, Dynamic, 1> DenseVector;
+
+   Index size;
+   bool sparse;
+
+   // sparse mode: sorted, unique indices and their values
+   std::vector<Index> idx;
+   std::vector<Scalar> val;
+
+   // dense mode
+   DenseVector dense;
+
+   HybridArray() : size(0), sparse(true) {}
+
+   void setZero(Index length){
+      size = length;
+      sparse = true;
+      idx.clear();
+      val.clear();
+      dense.resize(0);
+   }
+
+   Index nonZeros() const { return sparse ? Index(idx.size()) : size; }
+
+   Scalar operator()(Index i) const;
+
+   // expand to a dense vector (copy)
+   DenseVector toDense() const;
+
+   // switch to dense storage
+   void promote();
+
+   // promote if the nonzero count has passed the threshold
+   void checkDensity(){
+      if (sparse && double(idx.size()) > HybridStorage::dense_fraction*double(size)) {
+         promote();
+      }
+   }
+
+   // this *= alpha
+   void scale(Scalar alpha);
+
+   // return alpha*x + beta*y.  Sparse inputs merge in O(nnz),
+   // any dense input makes the result dense.
+   static HybridArray axpby(Scalar alpha, const HybridArray& x,
+                            Scalar beta, const HybridArray& y);
+
+   // this += sorted triplets (index, value); duplicates are summed
+   void addSorted(const std::vector<std::pair<Index, Scalar> >& entries);
+
+};
+
+
+
+template <typename Scalar>
+Scalar HybridArray<Scalar>::operator()(Index i) const {
+   if (!sparse) return dense(i);
+   auto it = std::lower_bound(idx.begin(), idx.end(), i);
+   if (it == idx.end() || *it != i) return Scalar(0);
+   return val[it - idx.begin()];
+}
+
+template <typename Scalar>
+typename HybridArray<Scalar>::DenseVector HybridArray<Scalar>::toDense() const {
+   if (!sparse) return dense;
+   DenseVector full = DenseVector::Zero(size);
+   for (std::size_t k = 0; k < idx.size(); ++k) {
+      full(idx[k]) = val[k];
+   }
+   return full;
+}
+
+template <typename Scalar>
+void HybridArray<Scalar>::promote() {
+   if (!sparse) return;
+   dense = toDense();
+   sparse = false;
+   idx.clear();
+   val.clear();
+}
+
+template <typename Scalar>
+void HybridArray<Scalar>::scale(Scalar alpha) {
+   if (sparse) {
+      for (auto& v : val) v *= alpha;
+   }
+   else {
+      dense *= alpha;
+   }
+}
+
+template <typename Scalar>
+HybridArray<Scalar> HybridArray<Scalar>::axpby(Scalar alpha, const HybridArray& x,
+                                               Scalar beta, const HybridArray& y) {
+   HybridArray result;
+   result.size = x.size;
+
+   if (x.sparse && y.sparse) {
+      // merge two sorted index lists
+      result.idx.reserve(x.idx.size() + y.idx.size());
+      result.val.reserve(x.idx.size() + y.idx.size());
+      std::size_t i = 0, j = 0;
+      while (i < x.idx.size() || j < y.idx.size()) {
+         if (j == y.idx.size() || (i < x.idx.size() && x.idx[i] < y.idx[j])) {
+            result.idx.push_back(x.idx[i]);
+            result.val.push_back(alpha*x.val[i]);
+            ++i;
+         }
+         else if (i == x.idx.size() || y.idx[j] < x.idx[i]) {
+            result.idx.push_back(y.idx[j]);
+            result.val.push_back(beta*y.val[j]);
+            ++j;
+         }
+         else {
+            result.idx.push_back(x.idx[i]);
+            result.val.push_back(alpha*x.val[i] + beta*y.val[j]);
+            ++i;
+            ++j;
+         }
+      }
+      result.checkDensity();
+      return result;
+   }
+
+   // at least one side is dense
+   result.sparse = false;
+   const HybridArray& d = x.sparse ? y : x;
+   const HybridArray& s = x.sparse ? x : y;
+   const Scalar dscale = x.sparse ? beta : alpha;
+   const Scalar sscale = x.sparse ? alpha : beta;
+   if (s.sparse) {
+      result.dense = dscale*d.dense;
+      for (std::size_t k = 0; k < s.idx.size(); ++k) {
+         result.dense(s.idx[k]) += sscale*s.val[k];
+      }
+   }
+   else {
+      result.dense = alpha*x.dense + beta*y.dense;
+   }
+   return result;
+}
+
+template <typename Scalar>
+void HybridArray<Scalar>::addSorted(const std::vector<std::pair<Index, Scalar> >& entries) {
+
+   if (!sparse) {
+      for (const auto& e : entries) dense(e.first) += e.second;
+      return;
+   }
+
+   std::vector<Index> new_idx;
+   std::vector<Scalar> new_val;
+   new_idx.reserve(idx.size() + entries.size());
+   new_val.reserve(idx.size() + entries.size());
+
+   std::size_t i = 0, k = 0;
+   while (i < idx.size() || k < entries.size()) {
+      Index next;
+      Scalar sum = Scalar(0);
+      if (k == entries.size() || (i < idx.size() && idx[i] <= entries[k].first)) {
+         next = idx[i];
+      }
+      else {
+         next = entries[k].first;
+      }
+      if (i < idx.size() && idx[i] == next) {
+         sum += val[i];
+         ++i;
+      }
+      while (k < entries.size() && entries[k].first == next) {
+         sum += entries[k].second;
+         ++k;
+      }
+      new_idx.push_back(next);
+      new_val.push_back(sum);
+   }
+   idx.swap(new_idx);
+   val.swap(new_val);
+   checkDensity();
+}
+
+
+// position of (i,j) in packed upper storage (64 bit, n may be large)
+inline Eigen::Index packedOffset(Eigen::Index i, Eigen::Index j) {
+   if (i > j) std::swap(i, j);
+   return j*(j+1)/2 + i;
+}
+
+// H += alpha * ( u*v^T + v*u^T ) with H in packed upper storage.
+// Only the products of the nonzeros of u and v are formed.
+template <typename Scalar>
+void symmetricRankUpdate(HybridArray<Scalar>& H,
+                         const HybridArray<Scalar>& u,
+                         const HybridArray<Scalar>& v,
+                         Scalar alpha) {
+
+   typedef typename HybridArray<Scalar>::Index Index;
+   typedef typename HybridArray<Scalar>::DenseVector DenseVector;
+
+   // gather the nonzeros of u and v
+   auto gather = [](const HybridArray<Scalar>& x,
+                    std::vector<Index>& ix, std::vector<Scalar>& vx) {
+      if (x.sparse) {
+         ix = x.idx;
+         vx = x.val;
+         return;
+      }
+      for (Index i = 0; i < x.size; ++i) {
+         if (x.dense(i) != Scalar(0)) {
+            ix.push_back(i);
+            vx.push_back(x.dense(i));
+         }
+      }
+   };
+
+   if (!H.sparse && !u.sparse && !v.sparse) {
+      // everything dense: column-wise axpy (see SymmetricMatrix::rankUpdate)
+      const DenseVector& ud = u.dense;
+      const DenseVector& vd = v.dense;
+      for (Index j = 0; j < u.size; ++j) {
+         H.dense.segment(j*(j+1)/2, j+1) += ud.head(j+1)*(alpha*vd(j))
+                                          + vd.head(j+1)*(alpha*ud(j));
+      }
+      return;
+   }
+
+   std::vector<Index> iu, iv;
+   std::vector<Scalar> vu, vv;
+   gather(u, iu, vu);
+   gather(v, iv, vv);
+
+   // the update touches at most |u|*|v| entries: promote up front
+   // rather than building a huge triplet list
+   if (H.sparse && double(iu.size())*double(iv.size())
+                      > HybridStorage::dense_fraction*double(H.size)) {
+      H.promote();
+   }
+
+   // pair (a,b) and (b,a) land on the same packed entry, which then
+   // collects u_a*v_b + u_b*v_a; the diagonal only shows up once
+   if (!H.sparse) {
+      for (std::size_t p = 0; p < iu.size(); ++p) {
+         for (std::size_t q = 0; q < iv.size(); ++q) {
+            const Index a = iu[p], b = iv[q];
+            const Scalar w = (a == b ? Scalar(2) : Scalar(1))*alpha*vu[p]*vv[q];
+            H.dense(packedOffset(a, b)) += w;
+         }
+      }
+      return;
+   }
+
+   std::vector<std::pair<Index, Scalar> > entries;
+   entries.reserve(iu.size()*iv.size());
+   for (std::size_t p = 0; p < iu.size(); ++p) {
+      for (std::size_t q = 0; q < iv.size(); ++q) {
+         const Index a = iu[p], b = iv[q];
+         const Scalar w = (a == b ? Scalar(2) : Scalar(1))*alpha*vu[p]*vv[q];
+         entries.push_back(std::make_pair(packedOffset(a, b), w));
+      }
+   }
+   std::sort(entries.begin(), entries.end(),
+             [](const std::pair<Index, Scalar>& l, const std::pair<Index, Scalar>& r) {
+                return l.first < r.first;
+             });
+   H.addSorted(entries);
+}
+
+
+
+// AD variable for large design spaces.
+// Same interface as AD<>, but grad and hess are HybridArrays:
+// an independent variable starts with one gradient nonzero and an
+// empty Hessian, and each intermediate only pays for the variables it
+// actually depends on until it becomes dense enough to be worth a
+// full vector/packed matrix.
+template <typename Scalar = Number>
+class ADHybrid {
+
+   public:
+
+   typedef Scalar Value;
+   typedef HybridArray<Scalar> Storage;
+
+   Value value;
+   Storage grad;
+   Storage hess;   // packed upper triangle, see SymmetricMatrix
+
+   // number of design space dimensions
+   int space_dim;
+
+   // location in the gradient space
+   int index;
+
+   // AD variables can have a name
+   std::string name;
+
+
+   // constructor for base variable initilization
+   ADHybrid(Value val, int space_size, int grad_index, std::string name="ADvar"){
+      value = val;
+      space_dim = space_size;
+      index = grad_index;
+      this->name = name;
+
+      grad.setZero(space_size);
+      hess.setZero(Eigen::Index(space_size)*(space_size+1)/2);
+
+      grad.idx.push_back(grad_index);
+      grad.val.push_back(Scalar(1));
+      grad.checkDensity();
+   }
+
+
+   // constructor for operations
+   ADHybrid(Value val, int space_size, std::string name="ADvar"){
+      value = val;
+      space_dim = space_size;
+      index = -1;
+      this->name = name;
+
+      grad.setZero(space_size);
+      hess.setZero(Eigen::Index(space_size)*(space_size+1)/2);
+   }
+
+   // full gradient / Hessian on demand
+   Eigen::Matrix<Scalar, Dynamic, 1> gradient() const { return grad.toDense(); }
+   Eigen::Matrix<Scalar, Dynamic, Dynamic> hessian() const;
+
+   // f(*this) from f, f' and f''
+   ADHybrid unary(Value f, Value d1, Value d2) const;
+
+   // f(*this, other) from its first and second partials
+   ADHybrid binary(const ADHybrid& other, Value f, Value dl, Value dr,
+                   Value dll, Value dlr, Value drr) const;
+
+   //-------------------------
+   // unary operations
+   ADHybrid operator-() const;
+
+   //-------------------------
+   // binary operations
+   ADHybrid operator+(const ADHybrid& other) const;
+   ADHybrid operator-(const ADHybrid& other) const;
+   ADHybrid operator*(const ADHybrid& other) const;
+   ADHybrid operator/(const ADHybrid& other) const;
+
+   ADHybrid operator+(Value other) const;
+   ADHybrid operator-(Value other) const;
+   ADHybrid operator*(Value other) const;
+   ADHybrid operator/(Value other) const;
+
+   ADHybrid& operator+=(const ADHybrid& other) { return *this = *this + other; }
+   ADHybrid& operator-=(const ADHybrid& other) { return *this = *this - other; }
+   ADHybrid& operator*=(const ADHybrid& other) { return *this = *this * other; }
+   ADHybrid& operator/=(const ADHybrid& other) { return *this = *this / other; }
+
+   ADHybrid& operator+=(Value other) { return *this = *this + other; }
+   ADHybrid& operator-=(Value other) { return *this = *this - other; }
+   ADHybrid& operator*=(Value other) { return *this = *this * other; }
+   ADHybrid& operator/=(Value other) { return *this = *this / other; }
+
+   //-------------------------
+   // printing
+   void print() const;
+
+};
+
+
+
+template <typename Scalar>
+Eigen::Matrix<Scalar, Dynamic, Dynamic> ADHybrid<Scalar>::hessian() const {
+   SymmetricMatrix<Scalar> packed;
+   packed.n = space_dim;
+   packed.data = hess.toDense();
+   return packed.dense();
+}
+
+// hess = f'*hess + f''*grad*grad^T
+template <typename Scalar>
+ADHybrid<Scalar> ADHybrid<Scalar>::unary(Value f, Value d1, Value d2) const {
+   ADHybrid result(f, space_dim);
+   result.grad = grad;
+   result.grad.scale(d1);
+   result.hess = hess;
+   result.hess.scale(d1);
+   if (d2 != Value(0)) symmetricRankUpdate(result.hess, grad, grad, Value(0.5)*d2);
+   return result;
+}
+
+// hess = dl*hess(l) + dr*hess(r) + dll*gl*gl^T + dlr*(gl*gr^T + gr*gl^T) + drr*gr*gr^T
+template <typename Scalar>
+ADHybrid<Scalar> ADHybrid<Scalar>::binary(const ADHybrid& other, Value f, Value dl, Value dr,
+                                          Value dll, Value dlr, Value drr) const {
+   ADHybrid result(f, space_dim);
+   result.grad = Storage::axpby(dl, grad, dr, other.grad);
+   result.hess = Storage::axpby(dl, hess, dr, other.hess);
+   if (dll != Value(0)) symmetricRankUpdate(result.hess, grad, grad, Value(0.5)*dll);
+   if (dlr != Value(0)) symmetricRankUpdate(result.hess, grad, other.grad, dlr);
+   if (drr != Value(0)) symmetricRankUpdate(result.hess, other.grad, other.grad, Value(0.5)*drr);
+   return result;
+}
+
+//-------------------------
+// unary operations
+template <typename Scalar>
+ADHybrid<Scalar> ADHybrid<Scalar>::operator-() const {
+   ADHybrid result(-value, space_dim);
+   result.grad = grad;
+   result.grad.scale(Scalar(-1));
+   result.hess = hess;
+   result.hess.scale(Scalar(-1));
+   return result;
+}
+
+//-------------------------
+// binary operations
+template <typename Scalar>
+ADHybrid<Scalar> ADHybrid<Scalar>::operator+(const ADHybrid& other) const {
+   ADHybrid result(value + other.value, space_dim);
+   result.grad = Storage::axpby(Scalar(1), grad, Scalar(1), other.grad);
+   result.hess = Storage::axpby(Scalar(1), hess, Scalar(1), other.hess);
+   return result;
+}
+
+template <typename Scalar>
+ADHybrid<Scalar> ADHybrid<Scalar>::operator-(const ADHybrid& other) const {
+   ADHybrid result(value - other.value, space_dim);
+   result.grad = Storage::axpby(Scalar(1), grad, Scalar(-1), other.grad);
+   result.hess = Storage::axpby(Scalar(1), hess, Scalar(-1), other.hess);
+   return result;
+}
+
+template <typename Scalar>
+ADHybrid<Scalar> ADHybrid<Scalar>::operator*(const ADHybrid& other) const {
+   ADHybrid result(value * other.value, space_dim);
+   result.grad = Storage::axpby(other.value, grad, value, other.grad);
+   result.hess = Storage::axpby(other.value, hess, value, other.hess);
+   symmetricRankUpdate(result.hess, grad, other.grad, Scalar(1));
+   return result;
+}
+
+// see AD<N>::operator/ for the form of the quotient rule
+template <typename Scalar>
+ADHybrid<Scalar> ADHybrid<Scalar>::operator/(const ADHybrid& other) const {
+   Value new_value = value / other.value;
+   Value inv = Value(1) / other.value;
+   ADHybrid result(new_value, space_dim);
+   result.grad = Storage::axpby(inv, grad, -new_value*inv, other.grad);
+   result.hess = Storage::axpby(inv, hess, -new_value*inv, other.hess);
+   symmetricRankUpdate(result.hess, result.grad, other.grad, -inv);
+   return result;
+}
+
+//----------------------------------------------------------------------
+// left var is ADHybrid, right var is a number
+template <typename Scalar>
+ADHybrid<Scalar> ADHybrid<Scalar>::operator+(Value other) const {
+   ADHybrid result(value + other, space_dim);
+   result.grad = grad;
+   result.hess = hess;
+   return result;
+}
+
+template <typename Scalar>
+ADHybrid<Scalar> ADHybrid<Scalar>::operator-(Value other) const {
+   ADHybrid result(value - other, space_dim);
+   result.grad = grad;
+   result.hess = hess;
+   return result;
+}
+
+template <typename Scalar>
+ADHybrid<Scalar> ADHybrid<Scalar>::operator*(Value other) const {
+   ADHybrid result(value * other, space_dim);
+   result.grad = grad;
+   result.grad.scale(other);
+   result.hess = hess;
+   result.hess.scale(other);
+   return result;
+}
+
+template <typename Scalar>
+ADHybrid<Scalar> ADHybrid<Scalar>::operator/(Value other) const {
+   return (*this) * (Value(1) / other);
+}
+
+//-------------------------
+// printing
+template <typename Scalar>
+void ADHybrid<Scalar>::print() const
+{
+   std::cout << "ADHybrid(" << name << std::endl;
+   std::cout << " design space size: (" << space_dim << ")" << std::endl;
+   std::cout << " value: " << value << "" << std::endl;
+   std::cout << " grad (" << (grad.sparse ? "sparse" : "dense") << ", "
+             << grad.nonZeros() << " nonzeros): \n" << gradient() << "" << std::endl;
+   std::cout << " hess (" << (hess.sparse ? "sparse" : "dense") << ", "
+             << hess.nonZeros() << " nonzeros): \n" << hessian() << "" << std::endl;
+   std::cout << "    )\n\n" << std::endl;
+}
+
+//-------------------------
+// r-operations (any arithmetic type, converted to Scalar)
+template <typename Scalar, typename U, if_arithmetic<U> = 0>
+ADHybrid<Scalar> operator+( U self , const ADHybrid<Scalar>& other) {
+   return other + Scalar(self);
+}
+template <typename Scalar, typename U, if_arithmetic<U> = 0>
+ADHybrid<Scalar> operator-( U self , const ADHybrid<Scalar>& other) {
+   return -other + Scalar(self);
+}
+template <typename Scalar, typename U, if_arithmetic<U> = 0>
+ADHybrid<Scalar> operator*( U self , const ADHybrid<Scalar>& other) {
+   return other * Scalar(self);
+}
+template <typename Scalar, typename U, if_arithmetic<U> = 0>
+ADHybrid<Scalar> operator/( U self , const ADHybrid<Scalar>& other) {
+   ADHybrid<Scalar> numerator(Scalar(self), other.space_dim, "numerator");
+   return numerator / other;
+}
+
+//-------------------------
+// elementary functions, with the partials of ADMath.h
+#define AD_HYBRID_FUNCTION(name)                                       \
+template <typename Scalar>                                             \
+ADHybrid<Scalar> name(const ADHybrid<Scalar>& x) {                     \
+   const ADPartials<Scalar> p = ad_partials::name(x.value);            \
+   return x.unary(p.f, p.d1, p.d2);                                    \
+}
+
+AD_HYBRID_FUNCTION(exp)
+AD_HYBRID_FUNCTION(log)
+AD_HYBRID_FUNCTION(log10)
+AD_HYBRID_FUNCTION(sqrt)
+AD_HYBRID_FUNCTION(cbrt)
+AD_HYBRID_FUNCTION(sin)
+AD_HYBRID_FUNCTION(cos)
+AD_HYBRID_FUNCTION(tan)
+AD_HYBRID_FUNCTION(asin)
+AD_HYBRID_FUNCTION(acos)
+AD_HYBRID_FUNCTION(atan)
+AD_HYBRID_FUNCTION(sinh)
+AD_HYBRID_FUNCTION(cosh)
+AD_HYBRID_FUNCTION(tanh)
+AD_HYBRID_FUNCTION(abs)
+
+#undef AD_HYBRID_FUNCTION
+
+template <typename Scalar, typename U, if_arithmetic<U> = 0>
+ADHybrid<Scalar> pow(const ADHybrid<Scalar>& x, U p) {
+   const ADPartials<Scalar> d = ad_partials::pow(x.value, p);
+   return x.unary(d.f, d.d1, d.d2);
+}
+
+// functions of two arguments
+#define AD_HYBRID_BINARY_FUNCTION(name, partials)                      \
+template <typename Scalar>                                             \
+ADHybrid<Scalar> name(const ADHybrid<Scalar>& l,                       \
+                      const ADHybrid<Scalar>& r) {                     \
+   const ADBinaryPartials<Scalar> p =                                  \
+      ad_partials::partials(l.value, r.value);                         \
+   return l.binary(r, p.f, p.dl, p.dr, p.dll, p.dlr, p.drr);           \
+}
+
+AD_HYBRID_BINARY_FUNCTION(pow, binary_pow)
+AD_HYBRID_BINARY_FUNCTION(atan2, atan2)
+AD_HYBRID_BINARY_FUNCTION(hypot, hypot)
+
+#undef AD_HYBRID_BINARY_FUNCTION
+
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef AD_JACOBIAN_H
+#define AD_JACOBIAN_H
+
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <vector>
+
+#include "ADChunk.h"
+
+
+// Multithreaded Jacobian of a vector function f: R^n -> R^m.
+//
+// The n seed directions are cut into chunks of K columns (as in
+// chunked_jacobian).  A pool of worker threads takes chunks from a
+// shared counter; each worker seeds its own ADGradient<K> inputs and
+// owns a thread-local ADArena for AD<> temporaries, then writes its
+// columns straight into the preallocated m x n Jacobian.  Workers
+// never touch the same columns, so there is no locking, and in
+// column major storage each chunk is one contiguous block.
+//
+// f is called concurrently from all workers, so it must not modify
+// shared state (a lambda capturing parameters by value or const
+// reference is fine).
+//
+//    MatrixXf J = jacobian<16>(residual, x);        // all hardware threads
+//    MatrixXf J = jacobian<16>(residual, x, 4);     // 4 threads
+//
+// threads = 0 uses std::thread::hardware_concurrency().  K = Dynamic
+// takes the chunk size as the last argument.
+template <int K, typename Scalar, typename F>
+Eigen::Matrix<Scalar, Dynamic, Dynamic> jacobian(const F& f, const Eigen::Matrix<Scalar, Dynamic, 1>& x,
+                                                 int threads = 0, int chunk = K) {
+
+   static_assert(K == Dynamic || K > 0, "chunk size must be positive");
+   eigen_assert(chunk > 0);
+
+   const int n = int(x.size());
+   const int m = output_size(f, x);
+   Eigen::Matrix<Scalar, Dynamic, Dynamic> J(m, n);
+
+   const int chunks = (n + chunk - 1) / chunk;
+   if (threads <= 0) threads = int(std::thread::hardware_concurrency());
+   threads = std::max(1, std::min(threads, chunks));
+
+   std::atomic<int> next(0);
+   std::exception_ptr error;
+   std::atomic<bool> failed(false);
+
+   auto worker = [&]() {
+      ADArena arena;
+      std::vector< ADChunkVariable<K, Scalar> > vars;
+      vars.reserve(n);
+      try {
+         for (int c = next++; c < chunks && !failed; c = next++) {
+            const int first = c*chunk;
+            const int width = std::min(chunk, n - first);
+            ADArenaScope scope(arena);
+            chunk_jacobian_pass<K>(f, x, vars, chunk, first, width, J);
+         }
+      }
+      catch (...) {
+         // keep the first error and stop the other workers
+         if (!failed.exchange(true)) error = std::current_exception();
+      }
+   };
+
+   // the calling thread is one of the workers
+   std::vector<std::thread> pool;
+   pool.reserve(threads - 1);
+   for (int t = 1; t < threads; ++t) pool.emplace_back(worker);
+   worker();
+   for (auto& t : pool) t.join();
+
+   if (error) std::rethrow_exception(error);
+   return J;
+}
+
+
+#endif
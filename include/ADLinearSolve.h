@@ -0,0 +1,116 @@
+#ifndef AD_LINEAR_SOLVE_H
+#define AD_LINEAR_SOLVE_H
+
+#include <algorithm>
+#include <type_traits>
+
+#include "ADEigen.h"
+
+
+// x = A^-1 b for AD matrices, with one factorization of the values.
+//
+// Pushing AD scalars through an LU factorization (ADEigen.h) repeats
+// the O(n^3) elimination for every derivative component.  Instead,
+// differentiate A x = b with respect to the parameters p_k:
+//
+//    A x_k  = b_k  - A_k x
+//    A x_kl = b_kl - A_kl x - A_k x_l - A_l x_k
+//
+// where A is the value of A(p) and x its solution.  The P first and
+// P(P+1)/2 second derivative right hand sides are assembled in
+// O(n^2) each from the gradients and Hessians of the entries, then all
+// of them are solved with the same PartialPivLU of the values:
+// O(n^3 + n^2 P^2) in total instead of O(n^3 P^2).
+//
+// The second derivative columns are in the packed upper triangle order
+// of SymmetricMatrix, so each row of the solution is the hess.data of
+// one entry of x.  Constant entries (AD<> with space_dim 0, e.g. the
+// zeros Eigen fills a matrix with) contribute no derivatives.
+//
+// A and b are any Eigen expressions of the same AD type (fixed or
+// dynamic size, blocks, maps); x has the size of b.
+//
+//    Eigen::Matrix<AD<>, Dynamic, 1> x = linear_solve(A, b);
+template <typename DA, typename DB>
+Eigen::Matrix<typename DA::Scalar, DB::SizeAtCompileTime, 1>
+linear_solve(const Eigen::MatrixBase<DA>& A, const Eigen::MatrixBase<DB>& b) {
+
+   typedef typename DA::Scalar T;
+   typedef typename T::Value V;
+   static_assert(std::is_same<typename DB::Scalar, T>::value, "A and b must hold the same AD type");
+
+   constexpr int N = T::dimension;
+   constexpr int Order = T::order;
+   typedef Eigen::Matrix<V, Dynamic, Dynamic> Matrix;
+   typedef Eigen::Matrix<V, Dynamic, 1> Vector;
+
+   const int n = int(A.rows());
+   eigen_assert(A.cols() == n && b.size() == n);
+
+   // design space size: the largest space_dim of any entry
+   int P = (N == Dynamic) ? 0 : N;
+   if constexpr (N == Dynamic) {
+      for (int j = 0; j < n; ++j) {
+         P = std::max(P, b(j).space_dim);
+         for (int i = 0; i < n; ++i) P = std::max(P, A(i, j).space_dim);
+      }
+   }
+
+   Matrix values(n, n);
+   Vector x0(n);
+   for (int j = 0; j < n; ++j) {
+      x0(j) = b(j).value;
+      for (int i = 0; i < n; ++i) values(i, j) = A(i, j).value;
+   }
+   const Eigen::PartialPivLU<Matrix> lu(values);
+   x0 = lu.solve(x0);
+
+   Eigen::Matrix<T, DB::SizeAtCompileTime, 1> x(n);
+   for (int i = 0; i < n; ++i) x(i) = T(x0(i), P);
+   if constexpr (Order >= 1) {
+      if (P == 0) return x;
+
+      // first derivatives:  A X1 = B1 - A_k x0, one column per parameter
+      Matrix X1 = Matrix::Zero(n, P);
+      for (int i = 0; i < n; ++i) {
+         if (!ad_constant(b(i))) X1.row(i) = b(i).grad.transpose().template cast<V>();
+         for (int j = 0; j < n; ++j) {
+            if (ad_constant(A(i, j))) continue;
+            X1.row(i) -= x0(j)*A(i, j).grad.transpose().template cast<V>();
+         }
+      }
+      X1 = lu.solve(X1);
+
+      for (int i = 0; i < n; ++i) x(i).grad = X1.row(i).transpose().template cast<typename T::Gradient::Scalar>();
+
+      if constexpr (Order >= 2) {
+
+         // second derivatives, packed column l*(l+1)/2 + k for k <= l:
+         //    A X2 = B2 - A_kl x0 - A_k X1_l - A_l X1_k
+         const int packed = P*(P + 1)/2;
+         Matrix X2 = Matrix::Zero(n, packed);
+         for (int i = 0; i < n; ++i) {
+            if (!ad_constant(b(i))) X2.row(i) = b(i).hess.data.transpose().template cast<V>();
+            for (int j = 0; j < n; ++j) {
+               const T& a = A(i, j);
+               if (ad_constant(a)) continue;
+               X2.row(i) -= x0(j)*a.hess.data.transpose().template cast<V>();
+               for (int l = 0; l < P; ++l) {
+                  const V gl = V(a.grad(l));
+                  const V xl = X1(j, l);
+                  for (int k = 0; k <= l; ++k) {
+                     X2(i, l*(l + 1)/2 + k) -= V(a.grad(k))*xl + gl*X1(j, k);
+                  }
+               }
+            }
+         }
+         X2 = lu.solve(X2);
+
+         for (int i = 0; i < n; ++i) x(i).hess.data = X2.row(i).transpose().template cast<typename T::Hessian::Storage::Scalar>();
+      }
+   }
+   return x;
+}
+
+
+#endif
@@ -0,0 +1,309 @@
+#ifndef AD_MATH_H
+#define AD_MATH_H
+
+#include <cmath>
+#include <utility>
+
+
+// Elementary functions of AD variables (included from
+// AutomaticDifferentiation.h).
+//
+// A function of one argument only needs f(x), f'(x) and f''(x) at the
+// value x of its argument; the chain rule is then one fused update
+//
+//    grad = f'*grad(x)
+//    hess = f'*hess(x) + f''*grad(x)*grad(x)^T
+//
+// On an expression this is an ADUnaryExpr node; on a dying AD (an
+// rvalue, e.g. exp(x*y) assigned through operator*) it is AD::apply,
+// in place.  Functions of two arguments are ADBinaryExpr nodes.
+//
+// Call them unqualified (exp(x), not std::exp(x)); they are found next
+// to the <cmath> overloads.
+
+
+// f(x), f'(x), f''(x)
+template <typename Value>
+struct ADPartials {
+   Value f, d1, d2;
+};
+
+// f(l, r) with its first (dl, dr) and second (dll, dlr, drr) partials
+template <typename Value>
+struct ADBinaryPartials {
+   Value f, dl, dr, dll, dlr, drr;
+};
+
+
+namespace ad_partials {
+
+// integer power by repeated squaring
+template <typename Value>
+Value ipow(Value x, long n) {
+   if (n < 0) {
+      x = Value(1) / x;
+      n = -n;
+   }
+   Value result(1);
+   while (n) {
+      if (n & 1) result *= x;
+      x *= x;
+      n >>= 1;
+   }
+   return result;
+}
+
+template <typename Value>
+ADPartials<Value> exp(Value x) {
+   const Value f = std::exp(x);
+   return {f, f, f};
+}
+
+template <typename Value>
+ADPartials<Value> log(Value x) {
+   const Value inv = Value(1) / x;
+   return {std::log(x), inv, -inv*inv};
+}
+
+template <typename Value>
+ADPartials<Value> log10(Value x) {
+   const Value inv = Value(1) / x;
+   const Value d1 = inv / std::log(Value(10));
+   return {std::log10(x), d1, -d1*inv};
+}
+
+template <typename Value>
+ADPartials<Value> sqrt(Value x) {
+   const Value f = std::sqrt(x);
+   const Value d1 = Value(0.5) / f;
+   return {f, d1, Value(-0.5)*d1 / x};
+}
+
+template <typename Value>
+ADPartials<Value> cbrt(Value x) {
+   const Value f = std::cbrt(x);
+   const Value d1 = f / (Value(3)*x);
+   return {f, d1, Value(-2)*d1 / (Value(3)*x)};
+}
+
+template <typename Value>
+ADPartials<Value> sin(Value x) {
+   const Value s = std::sin(x);
+   return {s, std::cos(x), -s};
+}
+
+template <typename Value>
+ADPartials<Value> cos(Value x) {
+   const Value c = std::cos(x);
+   return {c, -std::sin(x), -c};
+}
+
+template <typename Value>
+ADPartials<Value> tan(Value x) {
+   const Value f = std::tan(x);
+   const Value d1 = Value(1) + f*f;
+   return {f, d1, Value(2)*f*d1};
+}
+
+template <typename Value>
+ADPartials<Value> asin(Value x) {
+   const Value s = Value(1) / std::sqrt(Value(1) - x*x);
+   return {std::asin(x), s, x*s*s*s};
+}
+
+template <typename Value>
+ADPartials<Value> acos(Value x) {
+   const Value s = Value(1) / std::sqrt(Value(1) - x*x);
+   return {std::acos(x), -s, -x*s*s*s};
+}
+
+template <typename Value>
+ADPartials<Value> atan(Value x) {
+   const Value d1 = Value(1) / (Value(1) + x*x);
+   return {std::atan(x), d1, Value(-2)*x*d1*d1};
+}
+
+template <typename Value>
+ADPartials<Value> sinh(Value x) {
+   const Value s = std::sinh(x);
+   return {s, std::cosh(x), s};
+}
+
+template <typename Value>
+ADPartials<Value> cosh(Value x) {
+   const Value c = std::cosh(x);
+   return {c, std::sinh(x), c};
+}
+
+template <typename Value>
+ADPartials<Value> tanh(Value x) {
+   const Value f = std::tanh(x);
+   const Value d1 = Value(1) - f*f;
+   return {f, d1, Value(-2)*f*d1};
+}
+
+// f'' = 0 away from the kink; the derivative at 0 is taken as 0
+template <typename Value>
+ADPartials<Value> abs(Value x) {
+   const Value s = (x > Value(0)) ? Value(1) : (x < Value(0)) ? Value(-1) : Value(0);
+   return {std::abs(x), s, Value(0)};
+}
+
+// x^p: integer exponents by repeated squaring, so pow(x, 2) costs two
+// multiplies instead of exp(p*log(x)), and is exact at x <= 0
+template <typename Value, typename U>
+ADPartials<Value> pow(Value x, U p) {
+   if constexpr (std::is_integral<U>::value) {
+      const long n = long(p);
+      if (n == 0) return {Value(1), Value(0), Value(0)};
+      if (n == 1) return {x, Value(1), Value(0)};
+      const Value xm2 = ipow(x, n - 2);   // x^(n-2)
+      const Value xm1 = xm2*x;
+      return {xm1*x, Value(n)*xm1, Value(n)*Value(n - 1)*xm2};
+   }
+   else {
+      const Value q = Value(p);
+      if (x == Value(0)) {
+         return {std::pow(x, q), q*std::pow(x, q - Value(1)),
+                 q*(q - Value(1))*std::pow(x, q - Value(2))};
+      }
+      const Value f = std::pow(x, q);
+      const Value d1 = q*f / x;
+      return {f, d1, (q - Value(1))*d1 / x};
+   }
+}
+
+//-------------------------
+// functions of two arguments
+
+// u^v = exp(v log u):
+//    du = v u^(v-1),              dv = u^v log u
+//    duu = v(v-1) u^(v-2),        dvv = u^v log(u)^2
+//    duv = u^(v-1) (1 + v log u)
+// (not an overload of pow, which takes a constant exponent)
+template <typename Value>
+ADBinaryPartials<Value> binary_pow(Value u, Value v) {
+   const Value lu = std::log(u);
+   const Value f = std::pow(u, v);
+   const Value fu = f / u;   // u^(v-1)
+   return {f, v*fu, f*lu, v*(v - Value(1))*fu / u, fu*(Value(1) + v*lu), f*lu*lu};
+}
+
+// atan2(y, x), with r2 = x^2 + y^2:
+//    dy = x/r2,  dx = -y/r2
+//    dyy = -2xy/r2^2,  dxx = 2xy/r2^2,  dyx = (y^2 - x^2)/r2^2
+template <typename Value>
+ADBinaryPartials<Value> atan2(Value y, Value x) {
+   const Value inv = Value(1) / (x*x + y*y);
+   const Value c = Value(2)*x*y*inv*inv;
+   return {std::atan2(y, x), x*inv, -y*inv, -c, (y*y - x*x)*inv*inv, c};
+}
+
+// hypot(x, y) = h:
+//    dx = x/h,  dy = y/h
+//    dxx = y^2/h^3,  dyy = x^2/h^3,  dxy = -xy/h^3
+template <typename Value>
+ADBinaryPartials<Value> hypot(Value x, Value y) {
+   const Value h = std::hypot(x, y);
+   const Value inv = Value(1) / h;
+   const Value inv3 = inv*inv*inv;
+   return {h, x*inv, y*inv, y*y*inv3, -x*y*inv3, x*x*inv3};
+}
+
+} // namespace ad_partials
+
+
+
+//-------------------------
+// functions of one argument: an expression node, or in place on an
+// AD rvalue
+#define AD_UNARY_FUNCTION(name)                                         \
+template <typename E>                                                   \
+ADUnaryExpr<E> name(const ADExpr<E>& e) {                               \
+   typedef typename E::Result::Value Value;                             \
+   const E& x = e.derived();                                            \
+   const ADPartials<Value> p = ad_partials::name(Value(x.value));       \
+   ad_stats::operation<typename E::Result>(ad_stats::function,          \
+                                           x.space_dim);                \
+   return ADUnaryExpr<E>(x, p.f, p.d1, p.d2);                           \
+}                                                                       \
+template <typename A, if_reusable<A, A> = 0>                            \
+A name(A&& x) {                                                         \
+   const ADPartials<typename A::Value> p = ad_partials::name(x.value);  \
+   ad_stats::operation<A>(ad_stats::function, x.space_dim);             \
+   x.apply(p.f, p.d1, p.d2);                                            \
+   return std::move(x);                                                 \
+}
+
+AD_UNARY_FUNCTION(exp)
+AD_UNARY_FUNCTION(log)
+AD_UNARY_FUNCTION(log10)
+AD_UNARY_FUNCTION(sqrt)
+AD_UNARY_FUNCTION(cbrt)
+AD_UNARY_FUNCTION(sin)
+AD_UNARY_FUNCTION(cos)
+AD_UNARY_FUNCTION(tan)
+AD_UNARY_FUNCTION(asin)
+AD_UNARY_FUNCTION(acos)
+AD_UNARY_FUNCTION(atan)
+AD_UNARY_FUNCTION(sinh)
+AD_UNARY_FUNCTION(cosh)
+AD_UNARY_FUNCTION(tanh)
+AD_UNARY_FUNCTION(abs)
+
+#undef AD_UNARY_FUNCTION
+
+
+// x^p for a constant exponent p, converted to the scalar type of x
+template <typename E, typename U, if_arithmetic<U> = 0>
+ADUnaryExpr<E> pow(const ADExpr<E>& e, U p) {
+   typedef typename E::Result::Value Value;
+   const E& x = e.derived();
+   const ADPartials<Value> d = ad_partials::pow(Value(x.value), p);
+   ad_stats::operation<typename E::Result>(ad_stats::function, x.space_dim);
+   return ADUnaryExpr<E>(x, d.f, d.d1, d.d2);
+}
+
+template <typename A, typename U, if_reusable<A, A> = 0, if_arithmetic<U> = 0>
+A pow(A&& x, U p) {
+   const ADPartials<typename A::Value> d = ad_partials::pow(x.value, p);
+   ad_stats::operation<A>(ad_stats::function, x.space_dim);
+   x.apply(d.f, d.d1, d.d2);
+   return std::move(x);
+}
+
+// c^x:  d/dx = c^x log(c),  d2/dx2 = c^x log(c)^2
+template <typename E, typename U, if_arithmetic<U> = 0>
+ADScalarExpr<E, U> pow(U c, const ADExpr<E>& e) {
+   typedef typename ADScalarExpr<E, U>::Value Value;
+   const E& x = e.derived();
+   ad_stats::operation<typename ADScalarExpr<E, U>::Result>(ad_stats::function, x.space_dim);
+   const Value lc = std::log(Value(c));
+   const Value f = std::pow(Value(c), Value(x.value));
+   return ADScalarExpr<E, U>(x, f, f*lc, f*lc*lc);
+}
+
+//-------------------------
+// functions of two arguments, with the partials of ad_partials
+#define AD_BINARY_FUNCTION(name, partials)                              \
+template <typename L, typename R>                                       \
+ADBinaryExpr<L, R> name(const ADExpr<L>& l, const ADExpr<R>& r) {       \
+   typedef typename ADBinaryExpr<L, R>::Value Value;                    \
+   const L& a = l.derived();                                            \
+   const R& b = r.derived();                                            \
+   ad_stats::operation<typename ADBinaryExpr<L, R>::Result>(            \
+      ad_stats::binary_function, a.space_dim);                          \
+   const ADBinaryPartials<Value> p =                                    \
+      ad_partials::partials(Value(a.value), Value(b.value));            \
+   return ADBinaryExpr<L, R>(a, b, p.f, p.dl, p.dr,                     \
+                             p.dll, p.dlr, p.drr);                      \
+}
+
+AD_BINARY_FUNCTION(pow, binary_pow)
+AD_BINARY_FUNCTION(atan2, atan2)
+AD_BINARY_FUNCTION(hypot, hypot)
+
+#undef AD_BINARY_FUNCTION
+
+
+#endif
@@ -0,0 +1,556 @@
+#ifndef AD_PATTERN_H
+#define AD_PATTERN_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "AutomaticDifferentiation.h"
+
+
+// Dependency set of an AD variable: bit i is set when the variable
+// depends on input i.  Only the window of words from the lowest to the
+// highest set bit is stored, so an input costs one word and a variable
+// that depends on a few neighbouring inputs a few, however large n is.
+// Union is a word-wise OR over the window of the other set.
+class ADBitset {
+
+   public:
+
+   typedef std::uint64_t Word;
+   static constexpr int bits = 64;
+
+   // words[w] holds bits (first + w)*64 .. (first + w)*64 + 63
+   int first = 0;
+   std::vector<Word> words;
+
+   void set(int i) {
+      cover(i / bits, i / bits + 1);
+      words[i / bits - first] |= Word(1) << (i % bits);
+   }
+   bool test(int i) const {
+      const int w = i / bits - first;
+      return w >= 0 && w < int(words.size()) && ((words[w] >> (i % bits)) & Word(1));
+   }
+
+   ADBitset& operator|=(const ADBitset& other);
+
+   int count() const;
+
+   // the set bits in increasing order
+   std::vector<int> indices() const;
+
+   private:
+
+   // grow the window to hold the words begin .. end-1
+   void cover(int begin, int end);
+
+};
+
+
+inline void ADBitset::cover(int begin, int end) {
+   if (words.empty()) {
+      first = begin;
+      words.assign(end - begin, Word(0));
+      return;
+   }
+   const int last = first + int(words.size());
+   if (begin >= first && end <= last) return;
+   const int lo = std::min(begin, first);
+   std::vector<Word> grown(std::max(end, last) - lo, Word(0));
+   std::copy(words.begin(), words.end(), grown.begin() + (first - lo));
+   words.swap(grown);
+   first = lo;
+}
+
+inline ADBitset& ADBitset::operator|=(const ADBitset& other) {
+   if (other.words.empty()) return *this;
+   cover(other.first, other.first + int(other.words.size()));
+   Word* target = &words[other.first - first];
+   for (std::size_t w = 0; w < other.words.size(); ++w) target[w] |= other.words[w];
+   return *this;
+}
+
+inline int ADBitset::count() const {
+   int result = 0;
+   for (Word w : words) result += __builtin_popcountll(w);
+   return result;
+}
+
+inline std::vector<int> ADBitset::indices() const {
+   std::vector<int> result;
+   for (std::size_t w = 0; w < words.size(); ++w) {
+      Word word = words[w];
+      while (word) {
+         result.push_back((first + int(w))*bits + __builtin_ctzll(word));
+         word &= word - 1;
+      }
+   }
+   return result;
+}
+
+
+
+// Nonlinear interactions (i, j), i <= j, of one evaluation: the
+// structurally nonzero upper triangle of its Hessian.  Every nonlinear
+// ADPattern<2> operation appends its new pairs to the current set, as
+// ADReverse operations record to the current ADTape, so no variable
+// carries (or copies) interactions of its own.  Keys are j*2^32 + i,
+// i.e. column by column like SymmetricMatrix; compact() sorts them and
+// drops duplicates, and runs by itself whenever the keys have doubled.
+//
+//    ADPairSet pairs;
+//    ADPairSetScope scope(pairs);   // what hessian_sparsity does
+//    ADPattern<2> f = objective(x);
+//    ADSparsity H = hessian_pattern(pairs, n);
+class ADPairSet {
+
+   public:
+
+   typedef std::uint64_t Key;
+
+   std::vector<Key> keys;
+
+   static Key key(int i, int j) {
+      if (i > j) std::swap(i, j);
+      return (Key(j) << 32) | Key(i);
+   }
+   static int row(Key k) { return int(k & 0xffffffffu); }
+   static int col(Key k) { return int(k >> 32); }
+
+   // add every (i, j) with i in a and j in b
+   void add_outer(const ADBitset& a, const ADBitset& b);
+
+   // sorted keys without duplicates
+   void compact();
+
+   void reset() {
+      keys.clear();
+      compacted = 0;
+   }
+
+   std::size_t size() const { return keys.size(); }
+
+   // the set ADPattern<2> operations on this thread record to
+   // (nullptr = none, the interactions are not kept)
+   static ADPairSet*& current() {
+      thread_local ADPairSet* pairs = nullptr;
+      return pairs;
+   }
+
+   private:
+
+   // keys[0 .. compacted) are sorted and unique
+   std::size_t compacted = 0;
+
+};
+
+
+inline void ADPairSet::add_outer(const ADBitset& a, const ADBitset& b) {
+   const std::vector<int> ia = a.indices();
+   if (&a == &b) {
+      for (std::size_t k = 0; k < ia.size(); ++k) {
+         for (std::size_t l = k; l < ia.size(); ++l) keys.push_back(key(ia[k], ia[l]));
+      }
+   }
+   else {
+      const std::vector<int> ib = b.indices();
+      for (int i : ia) {
+         for (int j : ib) keys.push_back(key(i, j));
+      }
+   }
+   if (keys.size() > 2*compacted + 4096) compact();
+}
+
+inline void ADPairSet::compact() {
+   std::sort(keys.begin(), keys.end());
+   keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+   compacted = keys.size();
+}
+
+
+// Makes `pairs` the current ADPairSet of this thread for its lifetime
+// and resets it on exit.  Scopes nest; the previous set is restored.
+class ADPairSetScope {
+
+   public:
+
+   explicit ADPairSetScope(ADPairSet& pairs) : pairs(pairs), previous(ADPairSet::current()) {
+      ADPairSet::current() = &pairs;
+   }
+
+   ~ADPairSetScope() {
+      ADPairSet::current() = previous;
+      pairs.reset();
+   }
+
+   ADPairSetScope(const ADPairSetScope&) = delete;
+   ADPairSetScope& operator=(const ADPairSetScope&) = delete;
+
+   private:
+
+   ADPairSet& pairs;
+   ADPairSet* previous;
+
+};
+
+
+
+// Compressed sparse row pattern (no values).
+// Row r has the column indices col_idx[row_ptr[r] .. row_ptr[r+1]).
+struct ADSparsity {
+
+   int rows = 0;
+   int cols = 0;
+   std::vector<int> row_ptr;
+   std::vector<int> col_idx;
+
+   int nonZeros() const { return int(col_idx.size()); }
+
+   // dense 0/1 picture, for printing small patterns
+   Eigen::MatrixXi dense() const;
+
+};
+
+
+inline Eigen::MatrixXi ADSparsity::dense() const {
+   Eigen::MatrixXi full = Eigen::MatrixXi::Zero(rows, cols);
+   for (int r = 0; r < rows; ++r) {
+      for (int k = row_ptr[r]; k < row_ptr[r + 1]; ++k) full(r, col_idx[k]) = 1;
+   }
+   return full;
+}
+
+
+
+// Pattern-only AD: the value is computed as usual (so branches follow
+// the evaluation point) and the gradient is replaced by the dependency
+// bitset.  At Order 2 the Hessian is not carried at all: a nonlinear
+// operation adds its new interactions to the current ADPairSet.
+//
+//    +, -, scaling        grad = grad(l) | grad(r)
+//    *, /                 additionally pairs += grad(l) x grad(r)
+//                         (and grad(r) x grad(r) for /)
+//    nonlinear f(x)       additionally pairs += grad(x) x grad(x)
+//
+// Every operation is a word-wise OR over the dependency windows plus,
+// for nonlinear ones, appending the new pairs.  Compound assignment and
+// rvalue left operands update the variable in place, so a reduction
+// s += term costs the size of term, and a pass costs about one function
+// evaluation.  The recorded pairs are those of every operation, a
+// superset of the Hessian pattern when f computes values it then
+// discards.  Order 1 tracks the Jacobian pattern only.
+template <int Order = 2, typename Scalar = Number>
+class ADPattern {
+
+   public:
+
+   static_assert(Order == 1 || Order == 2, "ADPattern tracks order 1 or 2");
+
+   static constexpr int order = Order;
+   typedef Scalar Value;
+
+   Scalar value;
+   ADBitset grad;
+
+   // number of design space dimensions
+   int space_dim;
+
+   // location in the gradient space
+   int index;
+
+   // AD variables can have a name
+   std::string name;
+
+
+   // constructor for base variable initilization
+   ADPattern(Scalar val, int space_size, int grad_index, std::string name="ADvar")
+      : value(val), space_dim(space_size), index(grad_index), name(name) {
+      grad.set(index);
+   }
+
+   // constructor for operations
+   ADPattern(Scalar val, int space_size, std::string name="ADvar")
+      : value(val), space_dim(space_size), index(-1), name(name) {}
+
+   // f(*this), nonlinear when f'' is not identically zero
+   ADPattern unary(Scalar f, bool nonlinear) const;
+
+   // f(*this, other) with the second partials that are not identically
+   // zero: d2f/dl2 (ll), d2f/dldr (lr), d2f/dr2 (rr)
+   ADPattern binary(const ADPattern& other, Scalar f, bool ll, bool lr, bool rr) const;
+
+   // the same, replacing *this
+   ADPattern& apply(Scalar f, bool nonlinear);
+   ADPattern& combine(const ADPattern& other, Scalar f, bool ll, bool lr, bool rr);
+
+   //-------------------------
+   // unary operations
+   ADPattern operator-() const { return unary(-value, false); }
+
+   //-------------------------
+   // binary operations
+   ADPattern operator+(const ADPattern& other) const { return binary(other, value + other.value, false, false, false); }
+   ADPattern operator-(const ADPattern& other) const { return binary(other, value - other.value, false, false, false); }
+   ADPattern operator*(const ADPattern& other) const { return binary(other, value * other.value, false, true, false); }
+   ADPattern operator/(const ADPattern& other) const { return binary(other, value / other.value, false, true, true); }
+
+   ADPattern operator+(Scalar other) const { return unary(value + other, false); }
+   ADPattern operator-(Scalar other) const { return unary(value - other, false); }
+   ADPattern operator*(Scalar other) const { return unary(value * other, false); }
+   ADPattern operator/(Scalar other) const { return unary(value / other, false); }
+
+   // compound assignment, in place
+   ADPattern& operator+=(const ADPattern& other) { return combine(other, value + other.value, false, false, false); }
+   ADPattern& operator-=(const ADPattern& other) { return combine(other, value - other.value, false, false, false); }
+   ADPattern& operator*=(const ADPattern& other) { return combine(other, value * other.value, false, true, false); }
+   ADPattern& operator/=(const ADPattern& other) { return combine(other, value / other.value, false, true, true); }
+
+   ADPattern& operator+=(Scalar other) { return apply(value + other, false); }
+   ADPattern& operator-=(Scalar other) { return apply(value - other, false); }
+   ADPattern& operator*=(Scalar other) { return apply(value * other, false); }
+   ADPattern& operator/=(Scalar other) { return apply(value / other, false); }
+
+   //-------------------------
+   // printing
+   void print() const;
+
+};
+
+
+
+template <int Order, typename Scalar>
+ADPattern<Order, Scalar> ADPattern<Order, Scalar>::unary(Scalar f, bool nonlinear) const {
+   ADPattern result(*this);
+   result.apply(f, nonlinear);
+   return result;
+}
+
+template <int Order, typename Scalar>
+ADPattern<Order, Scalar> ADPattern<Order, Scalar>::binary(const ADPattern& other, Scalar f,
+                                                          bool ll, bool lr, bool rr) const {
+   ADPattern result(*this);
+   result.combine(other, f, ll, lr, rr);
+   return result;
+}
+
+template <int Order, typename Scalar>
+ADPattern<Order, Scalar>& ADPattern<Order, Scalar>::apply(Scalar f, bool nonlinear) {
+   if constexpr (Order == 2) {
+      ADPairSet* pairs = ADPairSet::current();
+      if (nonlinear && pairs) pairs->add_outer(grad, grad);
+   }
+   value = f;
+   index = -1;
+   return *this;
+}
+
+// the new pairs are recorded before grad takes in other.grad (which
+// may be grad itself)
+template <int Order, typename Scalar>
+ADPattern<Order, Scalar>& ADPattern<Order, Scalar>::combine(const ADPattern& other, Scalar f,
+                                                            bool ll, bool lr, bool rr) {
+   if constexpr (Order == 2) {
+      if (ADPairSet* pairs = ADPairSet::current()) {
+         if (ll) pairs->add_outer(grad, grad);
+         if (lr) pairs->add_outer(grad, other.grad);
+         if (rr) pairs->add_outer(other.grad, other.grad);
+      }
+   }
+   value = f;
+   index = -1;
+   grad |= other.grad;
+   return *this;
+}
+
+//-------------------------
+// printing
+template <int Order, typename Scalar>
+void ADPattern<Order, Scalar>::print() const
+{
+   std::cout << "ADPattern(" << name << std::endl;
+   std::cout << " design space size: (" << space_dim << ")" << std::endl;
+   std::cout << " value: " << value << "" << std::endl;
+   std::cout << " depends on: " << grad.count() << " inputs" << std::endl;
+   std::cout << "    )\n\n" << std::endl;
+}
+
+//-------------------------
+// rvalue left operands are updated in place and moved into the result
+template <int Order, typename Scalar>
+ADPattern<Order, Scalar> operator+(ADPattern<Order, Scalar>&& l, const ADPattern<Order, Scalar>& r) {
+   return std::move(l += r);
+}
+template <int Order, typename Scalar>
+ADPattern<Order, Scalar> operator-(ADPattern<Order, Scalar>&& l, const ADPattern<Order, Scalar>& r) {
+   return std::move(l -= r);
+}
+template <int Order, typename Scalar>
+ADPattern<Order, Scalar> operator*(ADPattern<Order, Scalar>&& l, const ADPattern<Order, Scalar>& r) {
+   return std::move(l *= r);
+}
+template <int Order, typename Scalar>
+ADPattern<Order, Scalar> operator/(ADPattern<Order, Scalar>&& l, const ADPattern<Order, Scalar>& r) {
+   return std::move(l /= r);
+}
+
+template <int Order, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADPattern<Order, Scalar> operator+(ADPattern<Order, Scalar>&& l, U r) { return std::move(l += Scalar(r)); }
+template <int Order, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADPattern<Order, Scalar> operator-(ADPattern<Order, Scalar>&& l, U r) { return std::move(l -= Scalar(r)); }
+template <int Order, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADPattern<Order, Scalar> operator*(ADPattern<Order, Scalar>&& l, U r) { return std::move(l *= Scalar(r)); }
+template <int Order, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADPattern<Order, Scalar> operator/(ADPattern<Order, Scalar>&& l, U r) { return std::move(l /= Scalar(r)); }
+
+//-------------------------
+// r-operations (any arithmetic type, converted to Scalar)
+template <int Order, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADPattern<Order, Scalar> operator+( U self , const ADPattern<Order, Scalar>& other) {
+   return other + Scalar(self);
+}
+template <int Order, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADPattern<Order, Scalar> operator-( U self , const ADPattern<Order, Scalar>& other) {
+   return other.unary(Scalar(self) - other.value, false);
+}
+template <int Order, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADPattern<Order, Scalar> operator*( U self , const ADPattern<Order, Scalar>& other) {
+   return other * Scalar(self);
+}
+template <int Order, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADPattern<Order, Scalar> operator/( U self , const ADPattern<Order, Scalar>& other) {
+   return other.unary(Scalar(self) / other.value, true);
+}
+
+//-------------------------
+// elementary functions: same names and values as ADMath.h
+#define AD_PATTERN_FUNCTION(name, nonlinear)                           \
+template <int Order, typename Scalar>                                                   \
+ADPattern<Order, Scalar> name(const ADPattern<Order, Scalar>& x) {                     \
+   return x.unary(ad_partials::name(x.value).f, nonlinear);            \
+}
+
+AD_PATTERN_FUNCTION(exp, true)
+AD_PATTERN_FUNCTION(log, true)
+AD_PATTERN_FUNCTION(log10, true)
+AD_PATTERN_FUNCTION(sqrt, true)
+AD_PATTERN_FUNCTION(cbrt, true)
+AD_PATTERN_FUNCTION(sin, true)
+AD_PATTERN_FUNCTION(cos, true)
+AD_PATTERN_FUNCTION(tan, true)
+AD_PATTERN_FUNCTION(asin, true)
+AD_PATTERN_FUNCTION(acos, true)
+AD_PATTERN_FUNCTION(atan, true)
+AD_PATTERN_FUNCTION(sinh, true)
+AD_PATTERN_FUNCTION(cosh, true)
+AD_PATTERN_FUNCTION(tanh, true)
+AD_PATTERN_FUNCTION(abs, false)
+
+#undef AD_PATTERN_FUNCTION
+
+// x^p is linear only for p = 0 or 1
+template <int Order, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADPattern<Order, Scalar> pow(const ADPattern<Order, Scalar>& x, U p) {
+   return x.unary(ad_partials::pow(x.value, p).f, p != U(0) && p != U(1));
+}
+
+template <int Order, typename Scalar>
+ADPattern<Order, Scalar> pow(const ADPattern<Order, Scalar>& l, const ADPattern<Order, Scalar>& r) {
+   return l.binary(r, std::pow(l.value, r.value), true, true, true);
+}
+
+template <int Order, typename Scalar>
+ADPattern<Order, Scalar> atan2(const ADPattern<Order, Scalar>& l, const ADPattern<Order, Scalar>& r) {
+   return l.binary(r, std::atan2(l.value, r.value), true, true, true);
+}
+
+template <int Order, typename Scalar>
+ADPattern<Order, Scalar> hypot(const ADPattern<Order, Scalar>& l, const ADPattern<Order, Scalar>& r) {
+   return l.binary(r, std::hypot(l.value, r.value), true, true, true);
+}
+
+
+
+//-------------------------
+// patterns in CSR form
+
+// m x n Jacobian pattern: row r = dependency set of output r
+template <int Order, typename Scalar>
+ADSparsity jacobian_pattern(const std::vector< ADPattern<Order, Scalar> >& outputs) {
+   ADSparsity J;
+   J.rows = int(outputs.size());
+   J.cols = outputs.empty() ? 0 : outputs[0].space_dim;
+   J.row_ptr.reserve(J.rows + 1);
+   J.row_ptr.push_back(0);
+   for (const auto& y : outputs) {
+      const std::vector<int> columns = y.grad.indices();
+      J.col_idx.insert(J.col_idx.end(), columns.begin(), columns.end());
+      J.row_ptr.push_back(int(J.col_idx.size()));
+   }
+   return J;
+}
+
+// n x n Hessian pattern (both triangles) of the pairs recorded over n
+// inputs
+inline ADSparsity hessian_pattern(ADPairSet& pairs, int n) {
+   pairs.compact();
+   std::vector< std::vector<int> > rows(n);
+   for (ADPairSet::Key k : pairs.keys) {
+      const int i = ADPairSet::row(k);
+      const int j = ADPairSet::col(k);
+      rows[i].push_back(j);
+      if (i != j) rows[j].push_back(i);
+   }
+   ADSparsity H;
+   H.rows = n;
+   H.cols = n;
+   H.row_ptr.reserve(n + 1);
+   H.row_ptr.push_back(0);
+   for (auto& r : rows) {
+      std::sort(r.begin(), r.end());
+      H.col_idx.insert(H.col_idx.end(), r.begin(), r.end());
+      H.row_ptr.push_back(int(H.col_idx.size()));
+   }
+   return H;
+}
+
+// seed n pattern inputs at the point x (any Eigen vector; the values
+// keep its scalar type, integers are promoted to Number)
+template <int Order, typename Derived>
+using ADPatternInputs = ADPattern<Order, typename std::common_type<typename Derived::Scalar, Number>::type>;
+
+template <int Order, typename Derived>
+std::vector< ADPatternInputs<Order, Derived> > pattern_inputs(const Eigen::MatrixBase<Derived>& x) {
+   typedef ADPatternInputs<Order, Derived> T;
+   std::vector<T> vars;
+   vars.reserve(x.size());
+   for (int i = 0; i < x.size(); ++i) vars.emplace_back(typename T::Value(x(i)), int(x.size()), i);
+   return vars;
+}
+
+// Jacobian pattern of the vector function f at x
+// (f is written once for any AD type, as for chunked_jacobian)
+template <typename F, typename Derived>
+ADSparsity jacobian_sparsity(F f, const Eigen::MatrixBase<Derived>& x) {
+   typedef ADPatternInputs<1, Derived> T;
+   const std::vector<T> vars = pattern_inputs<1>(x);
+   const auto outputs = f(vars);
+   return jacobian_pattern(std::vector<T>(outputs.begin(), outputs.end()));
+}
+
+// Hessian pattern of the scalar function f at x
+template <typename F, typename Derived>
+ADSparsity hessian_sparsity(F f, const Eigen::MatrixBase<Derived>& x) {
+   typedef ADPatternInputs<2, Derived> T;
+   ADPairSet pairs;
+   ADPairSetScope scope(pairs);
+   const std::vector<T> vars = pattern_inputs<2>(x);
+   f(vars);
+   return hessian_pattern(pairs, int(x.size()));
+}
+
+
+#endif
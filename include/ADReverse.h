@@ -0,0 +1,505 @@
+#ifndef AD_REVERSE_H
+#define AD_REVERSE_H
+
+#include <algorithm>
+#include <vector>
+
+#include "AutomaticDifferentiation.h"
+
+
+// Reverse mode (adjoint) gradients of scalar functions.
+//
+// Forward mode AD carries an n-length gradient through every
+// operation.  ADReverse<Scalar> carries only its value and the index
+// of a node on the current ADTape.  Each operation appends one node
+// holding the indices of its (at most two) operands and the local
+// partials:
+//
+//    node i:  parent[0], partial[0], parent[1], partial[1]
+//
+// One reverse sweep over the tape from the output y,
+//
+//    adjoint(y) = 1
+//    adjoint(parent[k]) += partial[k] * adjoint(i),   i = y .. 1
+//
+// leaves dy/dx in the adjoints of the inputs: the whole gradient for
+// a small constant multiple of the cost of f, independent of n.
+//
+// Node 0 is a sink: constants and missing operands point at it with a
+// zero partial, so the sweep never branches.  Number operands are not
+// recorded at all, only folded into the partials.
+//
+// The tape is one contiguous node array.  reset() (or the end of an
+// ADTapeScope) forgets the recording but keeps the capacity, so a tape
+// reused across evaluations stops allocating after the first one:
+//
+//    ADTape<> tape;
+//    for (...) {
+//       ADTapeScope<Number> scope(tape);       // record here
+//       std::vector< ADReverse<> > x = tape.variables(x0);
+//       ADReverse<> f = objective(x);
+//       VectorXf g = tape.gradient(f);        // before the scope ends
+//    }
+//
+// or reverse_gradient(f, x0, tape) below.  As with ADArena, each
+// thread has its own current tape.
+//
+// Order = 2 (ADHessianTape, ADHessianVariable) also records the second
+// partials ll, lr, rr of every node, for the forward-over-reverse
+// Hessian products further down.
+
+
+template <typename Scalar, int Order> class ADReverse;
+
+
+template <typename Scalar = Number, int Order = 1>
+class ADTape {
+
+   public:
+
+   static_assert(Order == 1 || Order == 2, "ADTape records first or second partials");
+
+   typedef ADReverse<Scalar, Order> Variable;
+
+   struct Node {
+      int parent[2];
+      Scalar partial[2];
+   };
+
+   // second partials of a node (Order 2 only)
+   struct Second {
+      Scalar ll, lr, rr;
+   };
+
+   typedef Eigen::Matrix<Scalar, Dynamic, 1> Gradient;
+   typedef Eigen::Matrix<Scalar, Dynamic, Dynamic> Matrix;
+
+   explicit ADTape(std::size_t capacity = 0) {
+      nodes.reserve(capacity + 1);
+      reset();
+   }
+
+   ADTape(const ADTape&) = delete;
+   ADTape& operator=(const ADTape&) = delete;
+
+   // forget the recording; the node array is kept for reuse
+   void reset() {
+      nodes.assign(1, Node{{0, 0}, {Scalar(0), Scalar(0)}});
+      seconds.assign(Order == 2 ? 1 : 0, Second{Scalar(0), Scalar(0), Scalar(0)});
+      inputs.clear();
+   }
+
+   // append a node, returning its index
+   int record(int p0, Scalar d0, int p1 = 0, Scalar d1 = Scalar(0),
+              Scalar ll = Scalar(0), Scalar lr = Scalar(0), Scalar rr = Scalar(0)) {
+      nodes.push_back(Node{{p0, p1}, {d0, d1}});
+      if constexpr (Order == 2) seconds.push_back(Second{ll, lr, rr});
+      return int(nodes.size()) - 1;
+   }
+
+   // new independent variable (the next gradient component)
+   Variable variable(Scalar value);
+
+   // one independent variable per entry of x
+   std::vector<Variable> variables(const Gradient& x);
+
+   // reverse sweep from y; afterwards adjoint(i) = dy/d(node i)
+   void sweep(const Variable& y);
+
+   Scalar adjoint(int node) const { return node < int(adjoints.size()) ? adjoints[node] : Scalar(0); }
+
+   // dy/dx for the variables in the order they were created
+   Gradient gradient(const Variable& y);
+
+   // H V for the n x K block of directions V (Order 2)
+   template <typename Derived>
+   Matrix hessian_product(const Variable& y, const Eigen::MatrixBase<Derived>& V);
+
+   // dense n x n Hessian, `block` columns per sweep (Order 2)
+   Matrix hessian(const Variable& y, int block = 16);
+
+   std::size_t size() const { return nodes.size(); }
+   std::size_t capacity() const { return nodes.capacity(); }
+   int variable_count() const { return int(inputs.size()); }
+
+   // the tape ADReverse operations on this thread record to
+   static ADTape*& current() {
+      thread_local ADTape* tape = nullptr;
+      return tape;
+   }
+
+   private:
+
+   std::vector<Node> nodes;
+   std::vector<Second> seconds;
+   std::vector<int> inputs;
+   std::vector<Scalar> adjoints;
+
+};
+
+
+// Makes `tape` the current tape of this thread for its lifetime and
+// resets it on exit.  Scopes nest; the previous tape is restored.
+template <typename Scalar, int Order = 1>
+class ADTapeScope {
+
+   public:
+
+   typedef ADTape<Scalar, Order> Tape;
+
+   explicit ADTapeScope(Tape& tape) : tape(tape), previous(Tape::current()) {
+      Tape::current() = &tape;
+   }
+
+   ~ADTapeScope() {
+      Tape::current() = previous;
+      tape.reset();
+   }
+
+   ADTapeScope(const ADTapeScope&) = delete;
+   ADTapeScope& operator=(const ADTapeScope&) = delete;
+
+   private:
+
+   Tape& tape;
+   Tape* previous;
+
+};
+
+
+
+// Scalar recorded on the current ADTape.  Only a value and a node
+// index (no name, no derivative storage), so copies are free.
+template <typename Scalar = Number, int Order = 1>
+class ADReverse {
+
+   public:
+
+   typedef Scalar Value;
+   typedef ADTape<Scalar, Order> Tape;
+
+   Value value;
+
+   // node on the tape, 0 for a constant
+   int index;
+
+   // constant: not recorded
+   ADReverse(Value val = Value(0)) : value(val), index(0) {}
+
+   ADReverse(Value val, int node) : value(val), index(node) {}
+
+   // f(*this) with f' = d1 (and f'' = d2)
+   ADReverse unary(Value f, Value d1, Value d2 = Value(0)) const {
+      return ADReverse(f, tape().record(index, d1, 0, Value(0), d2));
+   }
+
+   // f(*this, other) with first (and second) partials
+   ADReverse binary(const ADReverse& other, Value f, Value dl, Value dr,
+                    Value dll = Value(0), Value dlr = Value(0), Value drr = Value(0)) const {
+      return ADReverse(f, tape().record(index, dl, other.index, dr, dll, dlr, drr));
+   }
+
+   static Tape& tape() {
+      eigen_assert(Tape::current() && "ADReverse needs a current ADTape (ADTapeScope)");
+      return *Tape::current();
+   }
+
+   //-------------------------
+   // unary operations
+   ADReverse operator-() const { return unary(-value, Value(-1)); }
+
+   //-------------------------
+   // binary operations
+   ADReverse operator+(const ADReverse& other) const {
+      return binary(other, value + other.value, Value(1), Value(1));
+   }
+   ADReverse operator-(const ADReverse& other) const {
+      return binary(other, value - other.value, Value(1), Value(-1));
+   }
+   ADReverse operator*(const ADReverse& other) const {
+      return binary(other, value*other.value, other.value, value,
+                    Value(0), Value(1), Value(0));
+   }
+   // same partials as AD, see operator/ in ADExpression.h
+   ADReverse operator/(const ADReverse& other) const {
+      const Value inv = Value(1) / other.value;
+      const Value q = value*inv;
+      return binary(other, q, inv, -q*inv,
+                    Value(0), -inv*inv, Value(2)*q*inv*inv);
+   }
+
+   ADReverse operator+(Value other) const { return unary(value + other, Value(1)); }
+   ADReverse operator-(Value other) const { return unary(value - other, Value(1)); }
+   ADReverse operator*(Value other) const { return unary(value*other, other); }
+   ADReverse operator/(Value other) const { return (*this) * (Value(1) / other); }
+
+   ADReverse& operator+=(const ADReverse& other) { return *this = *this + other; }
+   ADReverse& operator-=(const ADReverse& other) { return *this = *this - other; }
+   ADReverse& operator*=(const ADReverse& other) { return *this = *this * other; }
+   ADReverse& operator/=(const ADReverse& other) { return *this = *this / other; }
+
+   ADReverse& operator+=(Value other) { return *this = *this + other; }
+   ADReverse& operator-=(Value other) { return *this = *this - other; }
+   ADReverse& operator*=(Value other) { return *this = *this * other; }
+   ADReverse& operator/=(Value other) { return *this = *this / other; }
+
+   //-------------------------
+   // printing
+   void print() const;
+
+};
+
+
+
+template <typename Scalar, int Order>
+ADReverse<Scalar, Order> ADTape<Scalar, Order>::variable(Scalar value) {
+   const int node = record(0, Scalar(0));
+   inputs.push_back(node);
+   return Variable(value, node);
+}
+
+template <typename Scalar, int Order>
+std::vector< ADReverse<Scalar, Order> > ADTape<Scalar, Order>::variables(const Gradient& x) {
+   std::vector<Variable> vars;
+   vars.reserve(x.size());
+   for (int i = 0; i < x.size(); ++i) vars.push_back(variable(x(i)));
+   return vars;
+}
+
+template <typename Scalar, int Order>
+void ADTape<Scalar, Order>::sweep(const Variable& y) {
+   adjoints.assign(y.index + 1, Scalar(0));
+   adjoints[y.index] = Scalar(1);
+   for (int i = y.index; i > 0; --i) {
+      const Scalar a = adjoints[i];
+      const Node& node = nodes[i];
+      adjoints[node.parent[0]] += node.partial[0]*a;
+      adjoints[node.parent[1]] += node.partial[1]*a;
+   }
+}
+
+template <typename Scalar, int Order>
+typename ADTape<Scalar, Order>::Gradient ADTape<Scalar, Order>::gradient(const Variable& y) {
+   sweep(y);
+   Gradient g(inputs.size());
+   for (int k = 0; k < int(inputs.size()); ++k) g(k) = adjoint(inputs[k]);
+   return g;
+}
+
+
+// Forward over reverse: with the tangents t(i) = d(node i)/dx V of a
+// forward sweep and the adjoints a(i) of the reverse sweep, the reverse
+// sweep of the tangent adjoints
+//
+//    ta(parent[k]) += partial[k]*ta(i) + a(i) * sum_l second[k][l]*t(parent[l])
+//
+// leaves H V in the rows ta(inputs): O(K) work per node, no n x n
+// storage.  Tangent rows of the sink node 0 stay zero.
+template <typename Scalar, int Order>
+template <typename Derived>
+typename ADTape<Scalar, Order>::Matrix
+ADTape<Scalar, Order>::hessian_product(const Variable& y, const Eigen::MatrixBase<Derived>& V) {
+
+   static_assert(Order == 2, "Hessian products need a tape of second partials (ADHessianTape)");
+   eigen_assert(V.rows() == int(inputs.size()));
+
+   typedef Eigen::Matrix<Scalar, Dynamic, Dynamic, Eigen::RowMajor> Rows;
+
+   const int m = y.index + 1;
+   const int K = int(V.cols());
+
+   sweep(y);
+
+   Rows t = Rows::Zero(m, K);
+   for (int k = 0; k < int(inputs.size()); ++k) {
+      if (inputs[k] < m) t.row(inputs[k]) = V.row(k).template cast<Scalar>();
+   }
+   for (int i = 1; i < m; ++i) {
+      const Node& node = nodes[i];
+      t.row(i) += node.partial[0]*t.row(node.parent[0]) + node.partial[1]*t.row(node.parent[1]);
+   }
+
+   Rows ta = Rows::Zero(m, K);
+   for (int i = m - 1; i > 0; --i) {
+      const Node& node = nodes[i];
+      const Second& d2 = seconds[i];
+      const Scalar a = adjoints[i];
+      const int p0 = node.parent[0];
+      const int p1 = node.parent[1];
+      ta.row(p0) += node.partial[0]*ta.row(i) + (a*d2.ll)*t.row(p0) + (a*d2.lr)*t.row(p1);
+      ta.row(p1) += node.partial[1]*ta.row(i) + (a*d2.lr)*t.row(p0) + (a*d2.rr)*t.row(p1);
+   }
+
+   Matrix HV(inputs.size(), K);
+   for (int k = 0; k < int(inputs.size()); ++k) {
+      if (inputs[k] < m) HV.row(k) = ta.row(inputs[k]);
+      else HV.row(k).setZero();
+   }
+   return HV;
+}
+
+template <typename Scalar, int Order>
+typename ADTape<Scalar, Order>::Matrix ADTape<Scalar, Order>::hessian(const Variable& y, int block) {
+   const int n = int(inputs.size());
+   Matrix H(n, n);
+   for (int first = 0; first < n; first += block) {
+      const int width = std::min(block, n - first);
+      H.middleCols(first, width) = hessian_product(y, Matrix::Identity(n, n).middleCols(first, width));
+   }
+   return H;
+}
+
+
+//-------------------------
+// printing
+template <typename Scalar, int Order>
+void ADReverse<Scalar, Order>::print() const
+{
+   std::cout << "ADReverse(" << std::endl;
+   std::cout << " value: " << value << "" << std::endl;
+   std::cout << " tape node: " << index << "" << std::endl;
+   std::cout << "    )\n\n" << std::endl;
+}
+
+//-------------------------
+// r-operations (any arithmetic type, converted to Scalar)
+template <typename Scalar, int Order, typename U, if_arithmetic<U> = 0>
+ADReverse<Scalar, Order> operator+( U self , const ADReverse<Scalar, Order>& other) {
+   return other + Scalar(self);
+}
+template <typename Scalar, int Order, typename U, if_arithmetic<U> = 0>
+ADReverse<Scalar, Order> operator-( U self , const ADReverse<Scalar, Order>& other) {
+   return other.unary(Scalar(self) - other.value, Scalar(-1));
+}
+template <typename Scalar, int Order, typename U, if_arithmetic<U> = 0>
+ADReverse<Scalar, Order> operator*( U self , const ADReverse<Scalar, Order>& other) {
+   return other * Scalar(self);
+}
+// c/v:  d/dv = -c/v^2,  d2/dv2 = 2c/v^3
+template <typename Scalar, int Order, typename U, if_arithmetic<U> = 0>
+ADReverse<Scalar, Order> operator/( U self , const ADReverse<Scalar, Order>& other) {
+   const Scalar inv = Scalar(1) / other.value;
+   const Scalar q = Scalar(self)*inv;
+   return other.unary(q, -q*inv, Scalar(2)*q*inv*inv);
+}
+
+//-------------------------
+// elementary functions, with the partials of ADMath.h
+#define AD_REVERSE_FUNCTION(name)                                      \
+template <typename Scalar, int Order>                                  \
+ADReverse<Scalar, Order> name(const ADReverse<Scalar, Order>& x) {     \
+   const ADPartials<Scalar> p = ad_partials::name(x.value);            \
+   return x.unary(p.f, p.d1, p.d2);                                    \
+}
+
+AD_REVERSE_FUNCTION(exp)
+AD_REVERSE_FUNCTION(log)
+AD_REVERSE_FUNCTION(log10)
+AD_REVERSE_FUNCTION(sqrt)
+AD_REVERSE_FUNCTION(cbrt)
+AD_REVERSE_FUNCTION(sin)
+AD_REVERSE_FUNCTION(cos)
+AD_REVERSE_FUNCTION(tan)
+AD_REVERSE_FUNCTION(asin)
+AD_REVERSE_FUNCTION(acos)
+AD_REVERSE_FUNCTION(atan)
+AD_REVERSE_FUNCTION(sinh)
+AD_REVERSE_FUNCTION(cosh)
+AD_REVERSE_FUNCTION(tanh)
+AD_REVERSE_FUNCTION(abs)
+
+#undef AD_REVERSE_FUNCTION
+
+template <typename Scalar, int Order, typename U, if_arithmetic<U> = 0>
+ADReverse<Scalar, Order> pow(const ADReverse<Scalar, Order>& x, U p) {
+   const ADPartials<Scalar> d = ad_partials::pow(x.value, p);
+   return x.unary(d.f, d.d1, d.d2);
+}
+
+// functions of two arguments
+#define AD_REVERSE_BINARY_FUNCTION(name, partials)                     \
+template <typename Scalar, int Order>                                  \
+ADReverse<Scalar, Order> name(const ADReverse<Scalar, Order>& l,       \
+                              const ADReverse<Scalar, Order>& r) {     \
+   const ADBinaryPartials<Scalar> p =                                  \
+      ad_partials::partials(l.value, r.value);                         \
+   return l.binary(r, p.f, p.dl, p.dr, p.dll, p.dlr, p.drr);           \
+}
+
+AD_REVERSE_BINARY_FUNCTION(pow, binary_pow)
+AD_REVERSE_BINARY_FUNCTION(atan2, atan2)
+AD_REVERSE_BINARY_FUNCTION(hypot, hypot)
+
+#undef AD_REVERSE_BINARY_FUNCTION
+
+
+// gradient of the scalar function f at x: one recording and one
+// reverse sweep on `tape` (reuse it across calls to keep its capacity)
+template <typename Scalar, int Order, typename F>
+Eigen::Matrix<Scalar, Dynamic, 1> reverse_gradient(F f, const Eigen::Matrix<Scalar, Dynamic, 1>& x,
+                                                   ADTape<Scalar, Order>& tape) {
+   ADTapeScope<Scalar, Order> scope(tape);
+   const std::vector< ADReverse<Scalar, Order> > vars = tape.variables(x);
+   const ADReverse<Scalar, Order> result = f(vars);
+   return tape.gradient(result);
+}
+
+template <typename Scalar, typename F>
+Eigen::Matrix<Scalar, Dynamic, 1> reverse_gradient(F f, const Eigen::Matrix<Scalar, Dynamic, 1>& x) {
+   ADTape<Scalar> tape;
+   return reverse_gradient(f, x, tape);
+}
+
+
+
+// Forward-over-reverse Hessians: f is recorded once with its second
+// partials, then every block of K directions costs one forward and one
+// reverse sweep of K-wide rows, O(K * cost of f) instead of the O(n^2)
+// per operation of AD.  The dense Hessian (n sweeps-worth) matches
+// AD::hess.dense(); for large sparse problems pass the compressed seed
+// matrix of a star coloring as V (see reverse_sparse_hessian in
+// ADColoring.h).
+template <typename Scalar = Number>
+using ADHessianTape = ADTape<Scalar, 2>;
+
+template <typename Scalar = Number>
+using ADHessianVariable = ADReverse<Scalar, 2>;
+
+
+// H V at x for the n x K directions V
+template <typename Scalar, typename F, typename Derived>
+Eigen::Matrix<Scalar, Dynamic, Dynamic> reverse_hessian_product(F f, const Eigen::Matrix<Scalar, Dynamic, 1>& x,
+                                                                const Eigen::MatrixBase<Derived>& V,
+                                                                ADHessianTape<Scalar>& tape) {
+   ADTapeScope<Scalar, 2> scope(tape);
+   const std::vector< ADHessianVariable<Scalar> > vars = tape.variables(x);
+   const ADHessianVariable<Scalar> result = f(vars);
+   return tape.hessian_product(result, V);
+}
+
+template <typename Scalar, typename F, typename Derived>
+Eigen::Matrix<Scalar, Dynamic, Dynamic> reverse_hessian_product(F f, const Eigen::Matrix<Scalar, Dynamic, 1>& x,
+                                                                const Eigen::MatrixBase<Derived>& V) {
+   ADHessianTape<Scalar> tape;
+   return reverse_hessian_product(f, x, V, tape);
+}
+
+// dense n x n Hessian at x, `block` columns per sweep
+template <typename Scalar, typename F>
+Eigen::Matrix<Scalar, Dynamic, Dynamic> reverse_hessian(F f, const Eigen::Matrix<Scalar, Dynamic, 1>& x,
+                                                        ADHessianTape<Scalar>& tape, int block = 16) {
+   ADTapeScope<Scalar, 2> scope(tape);
+   const std::vector< ADHessianVariable<Scalar> > vars = tape.variables(x);
+   const ADHessianVariable<Scalar> result = f(vars);
+   return tape.hessian(result, block);
+}
+
+template <typename Scalar, typename F>
+Eigen::Matrix<Scalar, Dynamic, Dynamic> reverse_hessian(F f, const Eigen::Matrix<Scalar, Dynamic, 1>& x,
+                                                        int block = 16) {
+   ADHessianTape<Scalar> tape;
+   return reverse_hessian(f, x, tape, block);
+}
+
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef AD_STATS_H
+#define AD_STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+
+// Operation, FLOP and allocation counters for AD.
+//
+// Compiled in only with -DAD_ENABLE_STATS.  Without it every hook below
+// is an empty inline function and ADCounted is an empty base, so the
+// instrumented code is exactly the uninstrumented code.
+//
+// With it, every AD operator, compound assignment and elementary
+// function counts one operation of its kind plus an estimate of its
+// FLOPs from the space_dim of its operands (g = n for a gradient, h =
+// n(n+1)/2 for a packed Hessian, each tracked by the result order):
+//
+//    linear, one operand     (neg, AD op Number)      2(g + h) + 1
+//    linear, two operands    (+, -)                   4(g + h) + 1
+//    nonlinear, one operand  (functions, Number/AD)   2(g + h) + 2h + 1
+//    nonlinear, two operands (*, /, atan2, ...)       4(g + h) + 4h + 1
+//
+// i.e. one multiply-add per derivative entry and operand plus the rank
+// update of the Hessian.  These are the dense costs; operations fused
+// by the expression templates are still counted one by one.
+//
+// It also counts the rank-1/rank-2 Hessian updates actually done, the
+// AD<> gradient/Hessian buffers allocated (heap or ADArena; fixed size
+// AD<N> storage is inline and never allocates), and the number of live
+// AD objects with its peak.
+//
+// All counters are process wide relaxed atomics, so they can be read
+// and reset from any thread:
+//
+//    ad_stats::reset();
+//    AD<> f = residual(x);
+//    ad_stats::snapshot().print();
+//
+// A snapshot reads each counter atomically, but is not one atomic cut
+// of all of them while other threads are still computing.
+
+
+namespace ad_stats {
+
+#ifdef AD_ENABLE_STATS
+constexpr bool enabled = true;
+#else
+constexpr bool enabled = false;
+#endif
+
+enum Operation {
+   add,              // AD + AD
+   sub,              // AD - AD
+   mul,              // AD * AD
+   div,              // AD / AD
+   neg,              // -AD
+   scalar,           // AD op Number, Number +-* AD
+   scalar_div,       // Number / AD
+   function,         // exp, sin, pow(x, p), ...
+   binary_function,  // pow(x, y), atan2, hypot
+   operation_kinds
+};
+
+inline const char* operation_name(int op) {
+   static const char* names[operation_kinds] = {
+      "add", "sub", "mul", "div", "neg", "scalar", "scalar_div",
+      "function", "binary_function"
+   };
+   return names[op];
+}
+
+} // namespace ad_stats
+
+
+// a copy of all counters
+struct ADStats {
+
+   std::uint64_t operations[ad_stats::operation_kinds] = {};
+   std::uint64_t flops = 0;
+   std::uint64_t hessian_updates = 0;
+   std::uint64_t heap_allocations = 0;
+   std::uint64_t heap_bytes = 0;
+   std::uint64_t arena_allocations = 0;
+   std::uint64_t arena_bytes = 0;
+   std::uint64_t live = 0;
+   std::uint64_t peak_live = 0;
+
+   std::uint64_t total_operations() const {
+      std::uint64_t total = 0;
+      for (std::uint64_t count : operations) total += count;
+      return total;
+   }
+
+   void print() const;
+
+};
+
+inline void ADStats::print() const {
+   if (!ad_stats::enabled) {
+      std::cout << "ADStats( not compiled in, build with -DAD_ENABLE_STATS )" << std::endl;
+      return;
+   }
+   std::cout << "ADStats(" << std::endl;
+   for (int op = 0; op < ad_stats::operation_kinds; ++op) {
+      std::cout << " " << ad_stats::operation_name(op) << ": " << operations[op] << std::endl;
+   }
+   std::cout << " operations: " << total_operations() << std::endl;
+   std::cout << " flops (estimate): " << flops << std::endl;
+   std::cout << " Hessian updates: " << hessian_updates << std::endl;
+   std::cout << " heap allocations: " << heap_allocations << " (" << heap_bytes << " bytes)" << std::endl;
+   std::cout << " arena allocations: " << arena_allocations << " (" << arena_bytes << " bytes)" << std::endl;
+   std::cout << " live AD objects: " << live << ", peak: " << peak_live << std::endl;
+   std::cout << "    )\n" << std::endl;
+}
+
+
+namespace ad_stats {
+
+#ifdef AD_ENABLE_STATS
+
+struct Counters {
+   std::atomic<std::uint64_t> operations[operation_kinds];
+   std::atomic<std::uint64_t> flops{0};
+   std::atomic<std::uint64_t> hessian_updates{0};
+   std::atomic<std::uint64_t> heap_allocations{0};
+   std::atomic<std::uint64_t> heap_bytes{0};
+   std::atomic<std::uint64_t> arena_allocations{0};
+   std::atomic<std::uint64_t> arena_bytes{0};
+   std::atomic<std::uint64_t> live{0};
+   std::atomic<std::uint64_t> peak_live{0};
+
+   Counters() { for (auto& count : operations) count.store(0); }
+};
+
+inline Counters& counters() {
+   static Counters c;
+   return c;
+}
+
+inline void bump(std::atomic<std::uint64_t>& counter, std::uint64_t by = 1) {
+   counter.fetch_add(by, std::memory_order_relaxed);
+}
+
+// estimated FLOPs of one operation, see the table above
+inline std::uint64_t flops(Operation op, int order, int n) {
+   const std::uint64_t g = order >= 1 ? std::uint64_t(n) : 0;
+   const std::uint64_t h = order >= 2 ? std::uint64_t(n)*(n + 1)/2 : 0;
+   switch (op) {
+      case add:
+      case sub:             return 4*(g + h) + 1;
+      case neg:
+      case scalar:          return 2*(g + h) + 1;
+      case mul:
+      case div:
+      case binary_function: return 4*(g + h) + 4*h + 1;
+      default:              return 2*(g + h) + 2*h + 1;
+   }
+}
+
+template <typename Result>
+inline void operation(Operation op, int n) {
+   Counters& c = counters();
+   bump(c.operations[op]);
+   bump(c.flops, flops(op, Result::order, n));
+}
+
+inline void hessian_update() { bump(counters().hessian_updates); }
+
+inline void allocation(std::size_t bytes, bool arena) {
+   Counters& c = counters();
+   bump(arena ? c.arena_allocations : c.heap_allocations);
+   bump(arena ? c.arena_bytes : c.heap_bytes, bytes);
+}
+
+inline void construct() {
+   Counters& c = counters();
+   const std::uint64_t live = c.live.fetch_add(1, std::memory_order_relaxed) + 1;
+   std::uint64_t peak = c.peak_live.load(std::memory_order_relaxed);
+   while (peak < live && !c.peak_live.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+}
+
+inline void destroy() { counters().live.fetch_sub(1, std::memory_order_relaxed); }
+
+inline ADStats snapshot() {
+   const Counters& c = counters();
+   ADStats s;
+   for (int op = 0; op < operation_kinds; ++op) s.operations[op] = c.operations[op].load();
+   s.flops = c.flops.load();
+   s.hessian_updates = c.hessian_updates.load();
+   s.heap_allocations = c.heap_allocations.load();
+   s.heap_bytes = c.heap_bytes.load();
+   s.arena_allocations = c.arena_allocations.load();
+   s.arena_bytes = c.arena_bytes.load();
+   s.live = c.live.load();
+   s.peak_live = c.peak_live.load();
+   return s;
+}
+
+// zero every counter; live objects stay counted and start the new peak
+inline void reset() {
+   Counters& c = counters();
+   for (auto& count : c.operations) count.store(0);
+   c.flops.store(0);
+   c.hessian_updates.store(0);
+   c.heap_allocations.store(0);
+   c.heap_bytes.store(0);
+   c.arena_allocations.store(0);
+   c.arena_bytes.store(0);
+   c.peak_live.store(c.live.load());
+}
+
+#else
+
+template <typename Result>
+inline void operation(Operation, int) {}
+inline void hessian_update() {}
+inline void allocation(std::size_t, bool) {}
+inline void construct() {}
+inline void destroy() {}
+inline ADStats snapshot() { return ADStats(); }
+inline void reset() {}
+
+#endif
+
+} // namespace ad_stats
+
+
+// Base of AD that counts live objects.  Empty either way, so it adds
+// nothing to sizeof(AD); without AD_ENABLE_STATS it is also trivial.
+#ifdef AD_ENABLE_STATS
+struct ADCounted {
+   ADCounted() noexcept { ad_stats::construct(); }
+   ADCounted(const ADCounted&) noexcept { ad_stats::construct(); }
+   ADCounted& operator=(const ADCounted&) noexcept { return *this; }
+   ~ADCounted() { ad_stats::destroy(); }
+};
+#else
+struct ADCounted {};
+#endif
+
+
+#endif
@@ -0,0 +1,489 @@
+#ifndef AD_TAYLOR_H
+#define AD_TAYLOR_H
+
+#include <cmath>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "AutomaticDifferentiation.h"
+
+
+// Truncated Taylor series of degree K along D directions at once
+// (univariate Taylor mode, for derivatives above the Hessian).
+//
+// Along direction s the inputs are x(t) = x0 + t*s and every
+// intermediate carries the coefficients of
+//
+//    f(x0 + t*s) = c_0 + c_1 t + c_2 t^2 + ... + c_K t^K
+//
+// so c_k = (1/k!) * the k-th directional derivative of f along s.
+// Each operation costs O(K^2) per direction, independent of the design
+// space size n, where nesting AD inside itself would need O(n^K)
+// storage.  Mixed partial tensors are recovered from several
+// directions with taylor_tensor() below.
+//
+// Storage is structure of arrays like ADBatch: row d of coeff belongs
+// to direction d, column k holds c_k of every direction.
+template <int K, int D = 1, typename Scalar = Number>
+class ADTaylor {
+
+   public:
+
+   static_assert(K >= 0 && D >= 1, "ADTaylor needs a degree K >= 0 and D >= 1 directions");
+
+   static constexpr int degree = K;
+
+   typedef Eigen::Array<Scalar, D, 1> Lanes;
+   typedef Eigen::Array<Scalar, D, K + 1> Coefficients;
+
+   Coefficients coeff;
+
+   // AD variables can have a name
+   std::string name;
+
+
+   // constructor for base variable initilization:
+   // component direction(d) of direction d lies along this variable
+   ADTaylor(Scalar val, const Lanes& direction, std::string name="ADvar"){
+      coeff.setZero();
+      coeff.col(0).setConstant(val);
+      if (K >= 1) coeff.col(1) = direction;
+      this->name = name;
+   }
+
+   // constant (and constructor for operations)
+   explicit ADTaylor(Scalar val = Scalar(0), std::string name="ADvar"){
+      coeff.setZero();
+      coeff.col(0).setConstant(val);
+      this->name = name;
+   }
+
+   Scalar value() const { return coeff(0, 0); }
+
+   // k-th directional derivative along every direction: k! * c_k
+   Lanes derivative(int k) const;
+
+   //-------------------------
+   // unary operations
+   ADTaylor operator-() const;
+
+   //-------------------------
+   // binary operations
+   ADTaylor operator+(const ADTaylor& other) const;
+   ADTaylor operator-(const ADTaylor& other) const;
+   ADTaylor operator*(const ADTaylor& other) const;
+   ADTaylor operator/(const ADTaylor& other) const;
+
+   ADTaylor operator+(Scalar other) const;
+   ADTaylor operator-(Scalar other) const;
+   ADTaylor operator*(Scalar other) const;
+   ADTaylor operator/(Scalar other) const;
+
+   //-------------------------
+   // printing
+   void print() const;
+
+};
+
+
+
+template <int K, int D, typename Scalar>
+typename ADTaylor<K, D, Scalar>::Lanes ADTaylor<K, D, Scalar>::derivative(int k) const {
+   Scalar factorial(1);
+   for (int j = 2; j <= k; ++j) factorial *= Scalar(j);
+   return coeff.col(k)*factorial;
+}
+
+//-------------------------
+// unary operations
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> ADTaylor<K, D, Scalar>::operator-() const {
+   ADTaylor result;
+   result.coeff = -coeff;
+   return result;
+}
+
+//-------------------------
+// binary operations
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> ADTaylor<K, D, Scalar>::operator+(const ADTaylor& other) const {
+   ADTaylor result;
+   result.coeff = coeff + other.coeff;
+   return result;
+}
+
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> ADTaylor<K, D, Scalar>::operator-(const ADTaylor& other) const {
+   ADTaylor result;
+   result.coeff = coeff - other.coeff;
+   return result;
+}
+
+// Cauchy product:  c_k = sum_{j=0..k} a_j b_(k-j)
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> ADTaylor<K, D, Scalar>::operator*(const ADTaylor& other) const {
+   ADTaylor result;
+   for (int k = 0; k <= K; ++k) {
+      Lanes c = coeff.col(0)*other.coeff.col(k);
+      for (int j = 1; j <= k; ++j) c += coeff.col(j)*other.coeff.col(k - j);
+      result.coeff.col(k) = c;
+   }
+   return result;
+}
+
+// q = a/b from a = q*b:  q_k = ( a_k - sum_{j=1..k} b_j q_(k-j) ) / b_0
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> ADTaylor<K, D, Scalar>::operator/(const ADTaylor& other) const {
+   ADTaylor result;
+   const Lanes inv = other.coeff.col(0).inverse();
+   for (int k = 0; k <= K; ++k) {
+      Lanes c = coeff.col(k);
+      for (int j = 1; j <= k; ++j) c -= other.coeff.col(j)*result.coeff.col(k - j);
+      result.coeff.col(k) = c*inv;
+   }
+   return result;
+}
+
+//----------------------------------------------------------------------
+// left var is ADTaylor, right var is a number
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> ADTaylor<K, D, Scalar>::operator+(Scalar other) const {
+   ADTaylor result(*this);
+   result.coeff.col(0) += other;
+   return result;
+}
+
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> ADTaylor<K, D, Scalar>::operator-(Scalar other) const {
+   ADTaylor result(*this);
+   result.coeff.col(0) -= other;
+   return result;
+}
+
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> ADTaylor<K, D, Scalar>::operator*(Scalar other) const {
+   ADTaylor result;
+   result.coeff = coeff*other;
+   return result;
+}
+
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> ADTaylor<K, D, Scalar>::operator/(Scalar other) const {
+   return (*this) * (Scalar(1) / other);
+}
+
+//-------------------------
+// printing
+template <int K, int D, typename Scalar>
+void ADTaylor<K, D, Scalar>::print() const
+{
+   std::cout << "ADTaylor(" << name << std::endl;
+   std::cout << " degree: " << K << ", directions: " << D << std::endl;
+   std::cout << " value: " << value() << "" << std::endl;
+   std::cout << " coefficients (row per direction): \n" << coeff << "" << std::endl;
+   std::cout << "    )\n\n" << std::endl;
+}
+
+//-------------------------
+// r-operations (any arithmetic type, converted to Scalar)
+template <int K, int D, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADTaylor<K, D, Scalar> operator+( U self , const ADTaylor<K, D, Scalar>& other) {
+   return other + Scalar(self);
+}
+template <int K, int D, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADTaylor<K, D, Scalar> operator-( U self , const ADTaylor<K, D, Scalar>& other) {
+   return -other + Scalar(self);
+}
+template <int K, int D, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADTaylor<K, D, Scalar> operator*( U self , const ADTaylor<K, D, Scalar>& other) {
+   return other * Scalar(self);
+}
+template <int K, int D, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADTaylor<K, D, Scalar> operator/( U self , const ADTaylor<K, D, Scalar>& other) {
+   return ADTaylor<K, D, Scalar>(Scalar(self)) / other;
+}
+
+
+
+//-------------------------
+// elementary functions
+//
+// All follow from f' = g(f, a) * a', matched term by term in t:
+// with k*f_k the coefficient of t^(k-1) in f',
+//
+//    f_k = 1/k * sum_{j=1..k} j a_j g_(k-j)
+//
+// which is O(K^2) when g_(k-j) is already known.
+
+// exp:  f' = f a'
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> exp(const ADTaylor<K, D, Scalar>& a) {
+   typedef typename ADTaylor<K, D, Scalar>::Lanes Lanes;
+   ADTaylor<K, D, Scalar> f;
+   f.coeff.col(0) = a.coeff.col(0).exp();
+   for (int k = 1; k <= K; ++k) {
+      Lanes c = a.coeff.col(1)*f.coeff.col(k - 1);
+      for (int j = 2; j <= k; ++j) c += Scalar(j)*a.coeff.col(j)*f.coeff.col(k - j);
+      f.coeff.col(k) = c/Scalar(k);
+   }
+   return f;
+}
+
+// log:  a f' = a'
+//    f_k = ( a_k - 1/k * sum_{j=1..k-1} j f_j a_(k-j) ) / a_0
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> log(const ADTaylor<K, D, Scalar>& a) {
+   typedef typename ADTaylor<K, D, Scalar>::Lanes Lanes;
+   ADTaylor<K, D, Scalar> f;
+   const Lanes inv = a.coeff.col(0).inverse();
+   f.coeff.col(0) = a.coeff.col(0).log();
+   for (int k = 1; k <= K; ++k) {
+      Lanes c = Lanes::Zero();
+      for (int j = 1; j < k; ++j) c += Scalar(j)*f.coeff.col(j)*a.coeff.col(k - j);
+      f.coeff.col(k) = (a.coeff.col(k) - c/Scalar(k))*inv;
+   }
+   return f;
+}
+
+// a^n for an integer n by repeated squaring of Cauchy products (see
+// ad_partials::ipow), so it is exact at a_0 = 0 where the recurrence
+// below divides by zero
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> taylor_ipow(ADTaylor<K, D, Scalar> a, long n) {
+   if (n < 0) {
+      a = ADTaylor<K, D, Scalar>(Scalar(1)) / a;
+      n = -n;
+   }
+   ADTaylor<K, D, Scalar> result(Scalar(1));
+   while (n) {
+      if (n & 1) result = result*a;
+      n >>= 1;
+      if (n) a = a*a;
+   }
+   return result;
+}
+
+// a^r for a constant r:  a f' = r f a'
+//    f_k = 1/(k a_0) * sum_{j=1..k} (r j - (k - j)) a_j f_(k-j)
+// integer exponents (or integer valued floating ones) use taylor_ipow
+template <int K, int D, typename Scalar, typename U, if_arithmetic<U> = 0>
+ADTaylor<K, D, Scalar> pow(const ADTaylor<K, D, Scalar>& a, U p) {
+   typedef typename ADTaylor<K, D, Scalar>::Lanes Lanes;
+   if constexpr (std::is_integral<U>::value) {
+      return taylor_ipow(a, long(p));
+   }
+   else if (p == std::trunc(p) && std::abs(p) <= U(std::numeric_limits<int>::max())) {
+      return taylor_ipow(a, long(p));
+   }
+   const Scalar r = Scalar(p);
+   ADTaylor<K, D, Scalar> f;
+   const Lanes inv = a.coeff.col(0).inverse();
+   f.coeff.col(0) = a.coeff.col(0).pow(r);
+   for (int k = 1; k <= K; ++k) {
+      Lanes c = Lanes::Zero();
+      for (int j = 1; j <= k; ++j) c += (r*Scalar(j) - Scalar(k - j))*a.coeff.col(j)*f.coeff.col(k - j);
+      f.coeff.col(k) = c*inv/Scalar(k);
+   }
+   return f;
+}
+
+// sqrt:  f^2 = a
+//    f_k = ( a_k - sum_{j=1..k-1} f_j f_(k-j) ) / (2 f_0)
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> sqrt(const ADTaylor<K, D, Scalar>& a) {
+   typedef typename ADTaylor<K, D, Scalar>::Lanes Lanes;
+   ADTaylor<K, D, Scalar> f;
+   f.coeff.col(0) = a.coeff.col(0).sqrt();
+   const Lanes inv = (Scalar(2)*f.coeff.col(0)).inverse();
+   for (int k = 1; k <= K; ++k) {
+      Lanes c = a.coeff.col(k);
+      for (int j = 1; j < k; ++j) c -= f.coeff.col(j)*f.coeff.col(k - j);
+      f.coeff.col(k) = c*inv;
+   }
+   return f;
+}
+
+// sin and cos together:  s' = c a',  c' = -s a'
+template <int K, int D, typename Scalar>
+void sincos(const ADTaylor<K, D, Scalar>& a, ADTaylor<K, D, Scalar>& s, ADTaylor<K, D, Scalar>& c) {
+   typedef typename ADTaylor<K, D, Scalar>::Lanes Lanes;
+   s.coeff.col(0) = a.coeff.col(0).sin();
+   c.coeff.col(0) = a.coeff.col(0).cos();
+   for (int k = 1; k <= K; ++k) {
+      Lanes sk = Lanes::Zero();
+      Lanes ck = Lanes::Zero();
+      for (int j = 1; j <= k; ++j) {
+         const Lanes ja = Scalar(j)*a.coeff.col(j);
+         sk += ja*c.coeff.col(k - j);
+         ck -= ja*s.coeff.col(k - j);
+      }
+      s.coeff.col(k) = sk/Scalar(k);
+      c.coeff.col(k) = ck/Scalar(k);
+   }
+}
+
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> sin(const ADTaylor<K, D, Scalar>& a) {
+   ADTaylor<K, D, Scalar> s, c;
+   sincos(a, s, c);
+   return s;
+}
+
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> cos(const ADTaylor<K, D, Scalar>& a) {
+   ADTaylor<K, D, Scalar> s, c;
+   sincos(a, s, c);
+   return c;
+}
+
+// tan:  f' = (1 + f^2) a',  tanh:  f' = (1 - f^2) a'
+// g = 1 +- f^2 is built alongside f, one coefficient behind
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> taylor_tan(const ADTaylor<K, D, Scalar>& a,
+                                  const typename ADTaylor<K, D, Scalar>::Lanes& f0,
+                                  Scalar sign) {
+   typedef typename ADTaylor<K, D, Scalar>::Lanes Lanes;
+   ADTaylor<K, D, Scalar> f, g;
+   f.coeff.col(0) = f0;
+   g.coeff.col(0) = Scalar(1) + sign*f.coeff.col(0).square();
+   for (int k = 1; k <= K; ++k) {
+      Lanes c = Lanes::Zero();
+      for (int j = 1; j <= k; ++j) c += Scalar(j)*a.coeff.col(j)*g.coeff.col(k - j);
+      f.coeff.col(k) = c/Scalar(k);
+      Lanes ff = Lanes::Zero();
+      for (int j = 0; j <= k; ++j) ff += f.coeff.col(j)*f.coeff.col(k - j);
+      g.coeff.col(k) = sign*ff;
+   }
+   return f;
+}
+
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> tan(const ADTaylor<K, D, Scalar>& a) {
+   return taylor_tan(a, a.coeff.col(0).tan(), Scalar(1));
+}
+
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> tanh(const ADTaylor<K, D, Scalar>& a) {
+   return taylor_tan(a, a.coeff.col(0).tanh(), Scalar(-1));
+}
+
+// atan:  f' = a' / (1 + a^2), i.e. f_k = 1/k * (k-th coefficient of f')
+template <int K, int D, typename Scalar>
+ADTaylor<K, D, Scalar> atan(const ADTaylor<K, D, Scalar>& a) {
+   ADTaylor<K, D, Scalar> da, f;
+   for (int k = 1; k <= K; ++k) da.coeff.col(k - 1) = Scalar(k)*a.coeff.col(k);
+   const ADTaylor<K, D, Scalar> df = da / (a*a + Scalar(1));
+   f.coeff.col(0) = a.coeff.col(0).atan();
+   for (int k = 1; k <= K; ++k) f.coeff.col(k) = df.coeff.col(k - 1)/Scalar(k);
+   return f;
+}
+
+
+
+//-------------------------
+// interpolation of mixed partials
+//
+// The degree d derivative tensor of f: R^n -> R has one entry per
+// multi-index j = (j_1, ..., j_n) with |j| = d, namely
+// d^d f / dx_1^j_1 ... dx_n^j_n.  It is recovered exactly from the
+// degree d Taylor coefficients c_d(i) along the directions s = i, for
+// every multi-index i with |i| = d (Griewank, Utke and Walther,
+// Math. Comp. 69, 2000):
+//
+//    d^j f = sum_i gamma(j, i) * c_d(i)
+//
+//    gamma(j, i) = sum_{0 < k <= j} (-1)^(d - |k|) C(j, k) C(d k/|k|, i) (|k|/d)^d
+//
+// with the multi-index binomials C(a, b) = prod_m C(a_m, b_m).
+// There are C(n + d - 1, d) such directions: seed them as the D
+// directions of an ADTaylor<K, D> with K >= d and map the result
+// through taylor_tensor.
+
+// every multi-index of n entries summing to d, in lexicographic order
+// (last entry fastest); both i and j above run over this list
+inline std::vector<Eigen::VectorXi> taylor_multi_indices(int n, int d) {
+   std::vector<Eigen::VectorXi> result;
+   Eigen::VectorXi i = Eigen::VectorXi::Zero(n);
+   i(0) = d;
+   while (true) {
+      result.push_back(i);
+      // move one unit from the last nonzero entry before the end to its right
+      int m = n - 2;
+      while (m >= 0 && i(m) == 0) --m;
+      if (m < 0) break;
+      i(m) -= 1;
+      const int rest = i(n - 1) + 1;
+      i(n - 1) = 0;
+      i(m + 1) = rest;
+   }
+   return result;
+}
+
+// the directions s = i as the columns of an n x D matrix:
+// row m holds the D direction components of input x_m
+template <typename Scalar = Number>
+Eigen::Matrix<Scalar, Dynamic, Dynamic> taylor_directions(int n, int d) {
+   const std::vector<Eigen::VectorXi> index = taylor_multi_indices(n, d);
+   Eigen::Matrix<Scalar, Dynamic, Dynamic> S(n, index.size());
+   for (std::size_t c = 0; c < index.size(); ++c) S.col(c) = index[c].cast<Scalar>();
+   return S;
+}
+
+// C(a, b) for real a and integer b >= 0
+inline double taylor_binomial(double a, int b) {
+   double result = 1.0;
+   for (int l = 0; l < b; ++l) result *= (a - l)/(l + 1);
+   return result;
+}
+
+// gamma(j, i) as a D x D matrix, row j and column i in the order of
+// taylor_multi_indices(n, d)
+template <typename Scalar = Number>
+Eigen::Matrix<Scalar, Dynamic, Dynamic> taylor_interpolation(int n, int d) {
+
+   const std::vector<Eigen::VectorXi> index = taylor_multi_indices(n, d);
+   const int size = int(index.size());
+   Eigen::MatrixXd gamma = Eigen::MatrixXd::Zero(size, size);
+
+   for (int r = 0; r < size; ++r) {
+      const Eigen::VectorXi& j = index[r];
+      // run k over 0 < k <= j (componentwise) like an odometer
+      Eigen::VectorXi k = Eigen::VectorXi::Zero(n);
+      while (true) {
+         int m = 0;
+         while (m < n && k(m) == j(m)) k(m++) = 0;
+         if (m == n) break;
+         k(m) += 1;
+
+         const int norm_k = k.sum();
+         double weight = ((d - norm_k) % 2) ? -1.0 : 1.0;
+         for (int l = 0; l < n; ++l) weight *= taylor_binomial(j(l), k(l));
+         weight *= std::pow(double(norm_k)/d, d);
+
+         for (int c = 0; c < size; ++c) {
+            double term = weight;
+            for (int l = 0; l < n; ++l) {
+               term *= taylor_binomial(double(d)*k(l)/norm_k, index[c](l));
+            }
+            gamma(r, c) += term;
+         }
+      }
+   }
+   return gamma.cast<Scalar>();
+}
+
+// degree d derivative tensor of f, one entry per multi-index of
+// taylor_multi_indices(n, d), from an ADTaylor seeded with
+// taylor_directions(n, d)
+template <int K, int D, typename Scalar>
+Eigen::Matrix<Scalar, Dynamic, 1> taylor_tensor(const ADTaylor<K, D, Scalar>& f, int n, int d) {
+   eigen_assert(d <= K);
+   const Eigen::Matrix<Scalar, Dynamic, Dynamic> gamma = taylor_interpolation<Scalar>(n, d);
+   eigen_assert(gamma.cols() == D);
+   return gamma * f.coeff.col(d).matrix();
+}
+
+
+#endif
@@ -0,0 +1,497 @@
+#ifndef AUTOMATIC_DIFFERENTIATION_H
+#define AUTOMATIC_DIFFERENTIATION_H
+
+#include <string>
+#include <type_traits>
+
+#include "GetEigen.h"
+#include "SymmetricMatrix.h"
+
+
+typedef float Number;
+
+#include "ADExpression.h"
+
+
+//https://eigen.tuxfamily.org/dox/TopicFunctionTakingEigenTypes.html
+//By letting your function take templated parameters of these base types,
+//you can let them play nicely with Eigen's expression templates.
+template <typename Derived>
+void print_size(const Eigen::EigenBase<Derived>& b)
+{
+  std::cout << "size (rows, cols): " << b.size() << " (" << b.rows()
+            << ", " << b.cols() << ")" << std::endl;
+}
+
+
+// N is the number of design space dimensions.
+// When N is known at compile time (AD<2>, AD<6>, ...) the gradient and
+// Hessian are fixed size Eigen matrices which live inside the AD object
+// itself, so the operators never touch the heap and Eigen can unroll
+// and vectorize the product/quotient rules.
+// AD<> (i.e. AD<Dynamic>) allocates its storage at run time, from the
+// current ADArena if one is active (see ADArena.h) or the heap.
+//
+// The Hessian is stored as a packed upper triangle (SymmetricMatrix);
+// use hess(i,j) or hess.dense() to read it back as a full matrix.
+//
+// The operators return expression nodes (see ADExpression.h); the
+// gradient and Hessian are evaluated when the node is assigned to an AD.
+//
+// Order is the highest derivative carried along:
+//    2   value, gradient and Hessian (default)
+//    1   value and gradient only -- no O(n^2) storage or work at all
+//    0   value only
+// ADGradient<N> and ADValue<N> below name the lower orders.
+//
+// Scalar, GradScalar and HessScalar are the scalar types of the value,
+// the gradient and the Hessian, e.g. AD<N, 2, double, double, float>
+// keeps a double value and gradient but halves the Hessian storage.
+template <int N = Dynamic, int Order = 2,
+          typename Scalar = Number,
+          typename GradScalar = Scalar,
+          typename HessScalar = GradScalar>
+class AD : public ADExpr< AD<N, Order, Scalar, GradScalar, HessScalar> >, ADCounted {
+
+   public:
+
+   static_assert(Order >= 0 && Order <= 2, "AD derivative order must be 0, 1 or 2");
+
+   static constexpr int order = Order;
+   static constexpr int dimension = N;
+
+   typedef AD Result;
+   typedef Scalar Value;
+   typedef typename std::conditional<(Order >= 1),
+                                     typename ADVectorType<GradScalar, N>::Type,
+                                     NoDerivative>::type Gradient;
+   typedef typename std::conditional<(Order >= 2),
+                                     SymmetricMatrix<HessScalar, N>,
+                                     NoDerivative>::type Hessian;
+
+   Value value;
+   Gradient grad;
+   Hessian hess;
+
+   // number of design space dimensions
+   int space_dim;
+
+   // location in the gradient space - i.e. where this variable "lives"
+   // in relation to the otheres in a design space.
+   int index;
+
+   // AD variables can have a name
+   std::string name;
+
+
+   // constructor for base variable initilization
+   AD(Value val, int space_size, int grad_index, std::string name="ADvar"){
+      eigen_assert(N == Dynamic || space_size == N);
+      value = val;            // AD value
+      space_dim = space_size; // size of design space
+      index = grad_index;     // which index in the gradient
+      this->name = name;      // variable name
+
+      //Eigen intrinsic for initialization
+      grad.setZero(space_size);
+      hess.setZero(space_size);
+
+      if constexpr (Order >= 1) grad(index) = GradScalar(1);
+   }
+
+
+   // constructor for operations
+   AD(Value val, int space_size, std::string name="ADvar"){
+      eigen_assert(N == Dynamic || space_size == N);
+      value = val;            // AD value
+      space_dim = space_size; // size of design space
+      index = -1;             // not an independent variable
+      this->name = name;
+
+      grad.setZero(space_size);
+      hess.setZero(space_size);
+
+   }
+
+   // constant: no derivative storage for AD<> (space_dim 0), zero
+   // derivatives for AD<N>; mixes with variables of any space size
+   AD(Value val = Value(0)) : AD(val, N == Dynamic ? 0 : N) {}
+
+   // evaluate an expression (or convert another AD type):
+   // one pass for gradient and Hessian
+   template <typename E>
+   AD(const ADExpr<E>& expr);
+
+   // the expression may refer to *this, so it is evaluated first
+   template <typename E>
+   AD& operator=(const ADExpr<E>& expr){
+      *this = AD(expr);
+      return *this;
+   }
+
+   // expression interface (leaf): g += wg*grad, H += wh*hess
+   template <typename W, typename G, typename H>
+   void accumulate(W wg, G& g, W wh, H& h) const {
+      if (ad_constant(*this)) return;
+      if constexpr (Order >= 1 && !std::is_same<G, NoDerivative>::value) {
+         add_scaled(g, grad, wg);
+      }
+      if constexpr (Order >= 2 && !std::is_same<H, NoDerivative>::value) {
+         if (wh != W(0)) add_scaled(h.data, hess.data, wh);
+      }
+   }
+
+   bool references(const void* p) const { return p == this; }
+
+   //-------------------------
+   // compound assignment, in place: no new gradient/Hessian buffers
+   // unless the right hand side refers to *this or one side is a constant
+   template <typename E> AD& operator+=(const ADExpr<E>& other);
+   template <typename E> AD& operator-=(const ADExpr<E>& other);
+   template <typename E> AD& operator*=(const ADExpr<E>& other);
+   template <typename E> AD& operator/=(const ADExpr<E>& other);
+
+   AD& operator+=(Value other);
+   AD& operator-=(Value other);
+   AD& operator*=(Value other);
+   AD& operator/=(Value other) { return (*this) *= (Value(1) / other); }
+
+   // replace x by f(x) in place, given f(x), f'(x) and f''(x):
+   //    grad = d1*grad,  hess = d1*hess + d2*grad*grad^T
+   AD& apply(Value f, Value d1, Value d2);
+
+   //-------------------------
+   // printing
+   void print_value();
+   void print_grad();
+   void print_hess();
+   void print_size();
+   void print();
+
+};
+
+
+
+template <int N, int Order, typename V, typename G, typename H>
+template <typename E>
+AD<N, Order, V, G, H>::AD(const ADExpr<E>& expr) {
+
+   const E& e = expr.derived();
+   value = Value(e.value);
+   space_dim = e.space_dim;
+   index = -1;
+   name = "ADvar";
+
+   grad.setZero(space_dim);
+   hess.setZero(space_dim);
+   e.accumulate(Value(1), grad, Value(1), hess);
+}
+
+
+//-------------------------
+// compound assignment
+template <int N, int Order, typename V, typename G, typename H>
+template <typename E>
+AD<N, Order, V, G, H>& AD<N, Order, V, G, H>::operator+=(const ADExpr<E>& other) {
+   const E& e = other.derived();
+   if (e.references(this) || e.space_dim != space_dim) return *this = AD(*this + e);
+   ad_stats::operation<AD>(ad_stats::add, space_dim);
+   value += Value(e.value);
+   e.accumulate(Value(1), grad, Value(1), hess);
+   return *this;
+}
+
+template <int N, int Order, typename V, typename G, typename H>
+template <typename E>
+AD<N, Order, V, G, H>& AD<N, Order, V, G, H>::operator-=(const ADExpr<E>& other) {
+   const E& e = other.derived();
+   if (e.references(this) || e.space_dim != space_dim) return *this = AD(*this - e);
+   ad_stats::operation<AD>(ad_stats::sub, space_dim);
+   value -= Value(e.value);
+   e.accumulate(Value(-1), grad, Value(-1), hess);
+   return *this;
+}
+
+// u *= v:
+//    hess = v*hess(u) + u*hess(v) + grad(u)grad(v)^T + grad(v)grad(u)^T
+//    grad = v*grad(u) + u*grad(v)
+// the Hessian goes first, while grad still holds grad(u)
+template <int N, int Order, typename V, typename G, typename H>
+template <typename E>
+AD<N, Order, V, G, H>& AD<N, Order, V, G, H>::operator*=(const ADExpr<E>& other) {
+   const E& e = other.derived();
+   if (e.references(this) || e.space_dim != space_dim) return *this = AD(*this * e);
+   ad_stats::operation<AD>(ad_stats::mul, space_dim);
+   const Value u = value;
+   const Value v = Value(e.value);
+   if constexpr (Order == 1) {
+      grad *= G(v);
+      e.accumulate(u, grad, Value(0), hess);
+   }
+   else if constexpr (Order == 2) {
+      hess.data *= H(v);
+      decltype(auto) gv = operand_gradient<Gradient>(e, hess, u);
+      hess.rankUpdate(grad, gv, H(1));
+      grad *= G(v);
+      add_scaled(grad, gv, u);
+   }
+   value = u*v;
+   return *this;
+}
+
+// u /= v, with q = u/v (see operator/ in ADExpression.h):
+//    grad = ( grad(u) - q*grad(v) ) / v
+//    hess = ( hess(u) - q*hess(v) - grad(q)grad(v)^T - grad(v)grad(q)^T ) / v
+template <int N, int Order, typename V, typename G, typename H>
+template <typename E>
+AD<N, Order, V, G, H>& AD<N, Order, V, G, H>::operator/=(const ADExpr<E>& other) {
+   const E& e = other.derived();
+   if (e.references(this) || e.space_dim != space_dim) return *this = AD(*this / e);
+   ad_stats::operation<AD>(ad_stats::div, space_dim);
+   const Value inv = Value(1) / Value(e.value);
+   const Value q = value*inv;
+   if constexpr (Order == 1) {
+      grad *= G(inv);
+      e.accumulate(-q*inv, grad, Value(0), hess);
+   }
+   else if constexpr (Order == 2) {
+      hess.data *= H(inv);
+      decltype(auto) gv = operand_gradient<Gradient>(e, hess, -q*inv);
+      add_scaled(grad, gv, -q);
+      grad *= G(inv);
+      hess.rankUpdate(grad, gv, H(-inv));
+   }
+   value = q;
+   return *this;
+}
+
+template <int N, int Order, typename V, typename G, typename H>
+AD<N, Order, V, G, H>& AD<N, Order, V, G, H>::operator+=(Value other) {
+   ad_stats::operation<AD>(ad_stats::scalar, space_dim);
+   value += other;
+   return *this;
+}
+
+template <int N, int Order, typename V, typename G, typename H>
+AD<N, Order, V, G, H>& AD<N, Order, V, G, H>::operator-=(Value other) {
+   ad_stats::operation<AD>(ad_stats::scalar, space_dim);
+   value -= other;
+   return *this;
+}
+
+template <int N, int Order, typename V, typename G, typename H>
+AD<N, Order, V, G, H>& AD<N, Order, V, G, H>::operator*=(Value other) {
+   ad_stats::operation<AD>(ad_stats::scalar, space_dim);
+   value *= other;
+   if constexpr (Order >= 1) grad *= G(other);
+   if constexpr (Order >= 2) hess.data *= H(other);
+   return *this;
+}
+
+template <int N, int Order, typename V, typename G, typename H>
+AD<N, Order, V, G, H>& AD<N, Order, V, G, H>::apply(Value f, Value d1, Value d2) {
+   if constexpr (Order >= 2) {
+      hess.data *= H(d1);
+      if (d2 != Value(0)) hess.rankUpdate(grad, H(d2));
+   }
+   if constexpr (Order >= 1) grad *= G(d1);
+   value = f;
+   return *this;
+}
+
+
+//-------------------------
+// rvalue operands: a dying AD is updated in place and moved into the
+// result, so f(x)*y + z or (a + b)*c reuse the buffers of the temporary
+// instead of allocating new ones.
+//
+// A&& with A deduced is a forwarding reference; the constraints below
+// only accept a non-const AD rvalue whose type the operation keeps
+// (mixed precision operands that promote take the expression path).
+
+template <typename A, typename B, typename = void>
+struct ad_reusable : std::false_type {};
+
+template <typename A, typename B>
+struct ad_reusable<A, B, typename std::enable_if<is_ad_leaf<A>::value &&
+                                                is_ad_leaf<typename std::decay<B>::type>::value>::type>
+   : std::is_same<typename ADPromote<A, typename std::decay<B>::type>::type, A> {};
+
+template <typename A, typename U, typename = void>
+struct ad_reusable_scalar : std::false_type {};
+
+template <typename A, typename U>
+struct ad_reusable_scalar<A, U, typename std::enable_if<is_ad_leaf<A>::value &&
+                                                       std::is_arithmetic<U>::value>::type>
+   : std::is_same<typename ADPromoteScalar<A, U>::type, A> {};
+
+template <typename A, typename B>
+using if_reusable = typename std::enable_if<ad_reusable<A, B>::value, int>::type;
+
+template <typename A, typename U>
+using if_reusable_scalar = typename std::enable_if<ad_reusable_scalar<A, U>::value, int>::type;
+
+
+// unary operations
+template <typename A, if_reusable<A, A> = 0>
+A operator-(A&& x) {
+   x *= typename A::Value(-1);
+   return std::move(x);
+}
+
+// binary operations
+template <typename A, typename E, if_reusable<A, typename E::Result> = 0>
+A operator+(A&& x, const ADExpr<E>& y) {
+   x += y;
+   return std::move(x);
+}
+template <typename E, typename B, if_reusable<B, typename E::Result> = 0>
+B operator+(const ADExpr<E>& x, B&& y) {
+   y += x;
+   return std::move(y);
+}
+template <typename A, typename B, if_reusable<A, B> = 0, if_reusable<B, B> = 0>
+A operator+(A&& x, B&& y) {
+   x += y;
+   return std::move(x);
+}
+
+template <typename A, typename E, if_reusable<A, typename E::Result> = 0>
+A operator-(A&& x, const ADExpr<E>& y) {
+   x -= y;
+   return std::move(x);
+}
+template <typename E, typename B, if_reusable<B, typename E::Result> = 0>
+B operator-(const ADExpr<E>& x, B&& y) {
+   // y is changed before x is read: x must not refer to it
+   if (x.derived().references(&y)) return B(x.derived() - y);
+   y *= typename B::Value(-1);
+   y += x;
+   return std::move(y);
+}
+template <typename A, typename B, if_reusable<A, B> = 0, if_reusable<B, B> = 0>
+A operator-(A&& x, B&& y) {
+   x -= y;
+   return std::move(x);
+}
+
+template <typename A, typename E, if_reusable<A, typename E::Result> = 0>
+A operator*(A&& x, const ADExpr<E>& y) {
+   x *= y;
+   return std::move(x);
+}
+template <typename E, typename B, if_reusable<B, typename E::Result> = 0>
+B operator*(const ADExpr<E>& x, B&& y) {
+   y *= x;
+   return std::move(y);
+}
+template <typename A, typename B, if_reusable<A, B> = 0, if_reusable<B, B> = 0>
+A operator*(A&& x, B&& y) {
+   x *= y;
+   return std::move(x);
+}
+
+template <typename A, typename E, if_reusable<A, typename E::Result> = 0>
+A operator/(A&& x, const ADExpr<E>& y) {
+   x /= y;
+   return std::move(x);
+}
+// x/y = x * (1/y), with 1/y formed in place
+template <typename E, typename B, if_reusable<B, typename E::Result> = 0>
+B operator/(const ADExpr<E>& x, B&& y) {
+   typedef typename B::Value Value;
+   if (x.derived().references(&y)) return B(x.derived() / y);
+   const Value inv = Value(1) / y.value;
+   y.apply(inv, -inv*inv, Value(2)*inv*inv*inv);
+   y *= x;
+   return std::move(y);
+}
+template <typename A, typename B, if_reusable<A, B> = 0, if_reusable<B, B> = 0>
+A operator/(A&& x, B&& y) {
+   x /= y;
+   return std::move(x);
+}
+
+// left var is AD, right var is a number
+template <typename A, typename U, if_reusable_scalar<A, U> = 0>
+A operator+(A&& x, U c) { x += c; return std::move(x); }
+template <typename A, typename U, if_reusable_scalar<A, U> = 0>
+A operator-(A&& x, U c) { x -= c; return std::move(x); }
+template <typename A, typename U, if_reusable_scalar<A, U> = 0>
+A operator*(A&& x, U c) { x *= c; return std::move(x); }
+template <typename A, typename U, if_reusable_scalar<A, U> = 0>
+A operator/(A&& x, U c) { x /= c; return std::move(x); }
+
+// r-operations
+template <typename A, typename U, if_reusable_scalar<A, U> = 0>
+A operator+(U c, A&& x) { x += c; return std::move(x); }
+template <typename A, typename U, if_reusable_scalar<A, U> = 0>
+A operator-(U c, A&& x) {
+   x *= typename A::Value(-1);
+   x += c;
+   return std::move(x);
+}
+template <typename A, typename U, if_reusable_scalar<A, U> = 0>
+A operator*(U c, A&& x) { x *= c; return std::move(x); }
+template <typename A, typename U, if_reusable_scalar<A, U> = 0>
+A operator/(U c, A&& x) {
+   typedef typename A::Value Value;
+   const Value inv = Value(1) / x.value;
+   const Value q = Value(c)*inv;
+   ad_stats::operation<A>(ad_stats::scalar_div, x.space_dim);
+   x.apply(q, -q*inv, Value(2)*q*inv*inv);
+   return std::move(x);
+}
+
+
+// first order only: value and gradient
+template <int N = Dynamic, typename Scalar = Number>
+using ADGradient = AD<N, 1, Scalar>;
+
+// value only: the plain function evaluation through the AD interface
+template <int N = Dynamic, typename Scalar = Number>
+using ADValue = AD<N, 0, Scalar>;
+
+
+
+//-------------------------
+// printing
+template <int N, int Order, typename V, typename G, typename H>
+void AD<N, Order, V, G, H>::print()
+{
+   std::cout << "AD(" << name << std::endl;
+   print_size();
+   print_value();
+   print_grad();
+   print_hess();
+   std::cout << "    )\n\n" << std::endl;
+}
+
+template <int N, int Order, typename V, typename G, typename H>
+void AD<N, Order, V, G, H>::print_value()
+{
+  std::cout << " value: " << value << "" << std::endl;
+}
+template <int N, int Order, typename V, typename G, typename H>
+void AD<N, Order, V, G, H>::print_grad()
+{
+  std::cout << " grad: \n" << grad << "" << std::endl;
+}
+template <int N, int Order, typename V, typename G, typename H>
+void AD<N, Order, V, G, H>::print_hess()
+{
+  std::cout << " hess: \n" << hess << "" << std::endl;
+}
+
+template <int N, int Order, typename V, typename G, typename H>
+void AD<N, Order, V, G, H>::print_size()
+{
+  std::cout << " design space size: (" << space_dim << ")" << std::endl;
+}
+
+
+
+#include "ADMath.h"
+
+
+#endif
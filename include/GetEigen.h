@@ -2,19 +2,27 @@
 
 //--------------------
 // Linux:
+// GCC flags the AVX-512 gemm kernels of Eigen as maybe-uninitialized
+// with -march=native, which -Werror (MakefileLinux) turns into errors
 #ifdef __linux__ 
+   #pragma GCC diagnostic push
+   #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
    #include <eigen/Eigen/Dense>
    #include  <eigen/Eigen/Core>
+   #include <eigen/Eigen/Sparse>
+   #pragma GCC diagnostic pop
 //--------------------
 // Windows:
 #elif _WIN32
    #include <Eigen\Dense>
    #include  <Eigen\Core>
+   #include <Eigen\Sparse>
 //--------------------
 // OSX (not correct yet)
 #elif __APPLE__ 
    #include <eigen/Eigen/Dense>
    #include  <eigen/Eigen/Core>
+   #include <eigen/Eigen/Sparse>
 #else
 #endif
 
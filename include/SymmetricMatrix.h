@@ -0,0 +1,125 @@
+#ifndef SYMMETRIC_MATRIX_H
+#define SYMMETRIC_MATRIX_H
+
+#include "GetEigen.h"
+#include "ADArena.h"
+
+
+// Packed storage for a symmetric n x n matrix.
+// Only the upper triangle is kept, column by column:
+//
+//    data = [ a00, a01, a11, a02, a12, a22, ... ]
+//
+// so entry (i,j) with i <= j lives at j*(j+1)/2 + i.
+// This is the layout LAPACK calls "UPLO = U" packed storage.
+// The Hessian of an AD variable is always symmetric, so this halves
+// both the memory and the work of every Hessian update.
+template <typename Scalar, int N = Dynamic>
+class SymmetricMatrix {
+
+   public:
+
+   static constexpr int Packed = (N == Dynamic) ? Dynamic : N*(N+1)/2;
+
+   typedef typename ADVectorType<Scalar, Packed>::Type Storage;
+   typedef Eigen::Matrix<Scalar, N, N> Dense;
+
+   // upper triangle, packed column by column
+   Storage data;
+
+   // number of rows (== number of columns)
+   int n;
+
+   SymmetricMatrix() : n(N == Dynamic ? 0 : N) {}
+
+   static int packed_size(int size) { return size*(size+1)/2; }
+
+   void setZero(int size){
+      n = size;
+      data.setZero(packed_size(size));
+   }
+
+   int rows() const { return n; }
+   int cols() const { return n; }
+
+   // position of (i,j) in the packed array
+   static int offset(int i, int j){
+      if (i > j) std::swap(i, j);
+      return j*(j+1)/2 + i;
+   }
+
+   Scalar operator()(int i, int j) const { return data(offset(i, j)); }
+   Scalar& operator()(int i, int j) { return data(offset(i, j)); }
+
+   // expand to the full matrix on demand
+   Dense dense() const;
+
+   // symmetric rank-2 update:  this += alpha * ( u*v^T + v*u^T )
+   template <typename U, typename V>
+   void rankUpdate(const Eigen::MatrixBase<U>& u,
+                   const Eigen::MatrixBase<V>& v,
+                   Scalar alpha);
+
+   // symmetric rank-1 update:  this += alpha * u*u^T
+   template <typename U>
+   void rankUpdate(const Eigen::MatrixBase<U>& u, Scalar alpha);
+
+};
+
+
+
+template <typename Scalar, int N>
+typename SymmetricMatrix<Scalar, N>::Dense SymmetricMatrix<Scalar, N>::dense() const {
+
+   Dense full(n, n);
+   for (int j = 0; j < n; ++j) {
+      const int start = j*(j+1)/2;
+      for (int i = 0; i <= j; ++i) {
+         full(i, j) = data(start + i);
+         full(j, i) = data(start + i);
+      }
+   }
+   return full;
+}
+
+
+// u and v may hold another scalar type (e.g. a double gradient updating
+// a float Hessian); they are converted column by column.
+//
+// column j of the packed upper triangle is the contiguous segment
+// data[j*(j+1)/2 .. j*(j+1)/2 + j], so each column update is a plain
+// axpy over the head of u and v that Eigen can vectorize.
+template <typename Scalar, int N>
+template <typename U, typename V>
+void SymmetricMatrix<Scalar, N>::rankUpdate(const Eigen::MatrixBase<U>& u,
+                                            const Eigen::MatrixBase<V>& v,
+                                            Scalar alpha) {
+
+   ad_stats::hessian_update();
+   for (int j = 0; j < n; ++j) {
+      const Scalar uj = alpha*Scalar(u(j));
+      const Scalar vj = alpha*Scalar(v(j));
+      data.segment(j*(j+1)/2, j+1) += u.head(j+1).template cast<Scalar>()*vj
+                                    + v.head(j+1).template cast<Scalar>()*uj;
+   }
+}
+
+template <typename Scalar, int N>
+template <typename U>
+void SymmetricMatrix<Scalar, N>::rankUpdate(const Eigen::MatrixBase<U>& u,
+                                            Scalar alpha) {
+
+   ad_stats::hessian_update();
+   for (int j = 0; j < n; ++j) {
+      data.segment(j*(j+1)/2, j+1) += u.head(j+1).template cast<Scalar>()*(alpha*Scalar(u(j)));
+   }
+}
+
+
+template <typename Scalar, int N>
+std::ostream& operator<<(std::ostream& os, const SymmetricMatrix<Scalar, N>& m) {
+   return os << m.dense();
+}
+
+
+#endif
@@ -1,353 +1,20 @@
-
-
-#include "../include/GetEigen.h"
-
-
-typedef float Number;
-
-
-//https://eigen.tuxfamily.org/dox/TopicFunctionTakingEigenTypes.html
-//By letting your function take templated parameters of these base types, 
-//you can let them play nicely with Eigen's expression templates.
-template <typename Derived>
-void print_size(const Eigen::EigenBase<Derived>& b)
-{
-  std::cout << "size (rows, cols): " << b.size() << " (" << b.rows()
-            << ", " << b.cols() << ")" << std::endl;
-}
-
-class AD {
-
-   public:
-
-   Number value;
-   Eigen::Matrix<Number, Dynamic, 1> grad;
-   Eigen::Matrix<Number, Dynamic, Dynamic> hess;
-
-   // shape of the hessian (redundant really)
-   Eigen::Matrix<int, 2, 1> shape;
-
-   // number of design space dimensions
-   int space_dim;
-
-   // location in the gradient space - i.e. where this variable "lives"
-   // in relation to the otheres in a design space.
-   int index;
-
-   // AD variables can have a name
-   std::string name;
-
-
-   // constructor for base variable initilization
-   AD(Number val, int space_size, int grad_index, std::string name="ADvar"){
-      value = val;            // AD value
-      space_dim = space_size; // size of design space
-      index = grad_index;     // which index in the gradient
-      name=name;              // variable name 
-
-      //Eigen intrinsic for initialization
-      grad.setZero(space_size);
-      hess.setZero(space_size, space_size);
-
-      grad(index) = 1.0;
-   }
-
-
-   // constructor for operations
-   AD(Number val, int space_size, std::string name="ADvar"){
-      value = val;            // AD value
-      space_dim = space_size; // size of design space
-      //index = index;     // which index in the gradient
-      name=name;
-
-      grad.setZero(space_size);
-      hess.setZero(space_size, space_size);
-
-   }
-
-   //-------------------------
-   // unary operations
-   AD operator-();
-
-   //-------------------------
-   // binary operations
-   AD operator+(const AD& other);
-   AD operator-(const AD& other);
-   AD operator*(const AD& other);
-   AD operator/(const AD& other);
-
-   AD operator+(Number other);
-   AD operator-(Number other);
-   AD operator*(Number other);
-   AD operator/(Number other);
-
-   //-------------------------
-   // printing
-   void print_value();
-   void print_grad();
-   void print_hess();
-   void print_size();
-   void print();
-
-   //-------------------------
-   //AD One = 
-};
-
-
-
-//-------------------------
-// unary operations
-AD AD::operator-() {
-
-   Number new_value = -value;
-   int space_size = space_dim;
-   AD result(new_value, space_size);
-   result.grad = -grad;
-   result.hess = -hess;
-   return result;
-}
-
-//-------------------------
-// binary operations
-
-AD AD::operator+(const AD& other) {
-
-   Number new_value = value + other.value;
-   //std::cout << " adding " << value << " to " << other.value << std::endl;
-   int space_size = space_dim;
-
-   AD result(new_value, space_size);
-   result.grad = grad + other.grad;
-   result.hess = hess + other.hess;
-   return result;
-
-}
-
-AD AD::operator-(const AD& other) {
-
-   Number new_value = value - other.value;
-   int space_size = space_dim;
-   AD result(new_value, space_size);
-   result.grad = grad - other.grad;
-   result.hess = hess - other.hess;
-   return result;
-}
-
-AD AD::operator*(const AD& other) {
-
-   Number new_value = value * other.value;
-   int space_size = space_dim;
-   AD result(new_value, space_size);
-   result.grad = grad*other.value + other.grad*value;
-   result.hess =  other.value*hess + \
-                  other.grad * grad.transpose() + \
-                  grad * other.grad.transpose() + \
-                  other.hess * value;
-
-   return result;
-
-}
-
-
-AD AD::operator/(const AD& other) {
-
-   Number new_value = value / other.value;
-   int space_size = space_dim;
-
-   AD result(new_value, space_size);
-
-   // store components of the gradient:
-   // scalar:
-   Number bottom = other.value*other.value;
-   /*
-   // vector:
-   Eigen::Matrix<Number, Dynamic, 1> top;
-   top.setZero(space_size);
-   top = other.value*grad - value*other.grad;
-
-
-   // compute the gradient:
-   result.grad = (top)/(bottom);
-
-
-   // store components of the Hessian:
-   Eigen::Matrix<Number, Dynamic, 1> dbottom;
-   dbottom.setZero(space_size);
-   dbottom = other.value*other.grad - other.value*other.grad;
-
-   // store components of the Hessian:
-   Eigen::Matrix<Number, Dynamic, Dynamic>  dtop;
-   dtop.setZero(space_size, space_size);
-   dtop =   (
-               other.grad * grad.transpose() + \
-               other.value * hess
-            ) - \
-            (
-               grad * other.grad.transpose() + \
-               value*other.hess
-            );
-
-   // compute the Hessian:
-   result.hess = ( (bottom * dtop) - (top * dbottom.transpose()) )  / (bottom*bottom);
-   */
-
-   // more efficient (?) (drops the temporaries... 
-   // which makes for extra computation but less memory action)
-   /**/
-   // compute the gradient (memory efficient):
-   result.grad = (other.value*grad - value*other.grad)/(bottom);
-
-   // compute the Hessian (without temporaries this time):
-   result.hess =  (  bottom * \
-                              (
-                                 (
-                                    other.grad * grad.transpose() + \
-                                    other.value * hess
-                                 ) - \
-                                 (
-                                    grad * other.grad.transpose() + \
-                                    value*other.hess
-                                 )
-                              )
-                              - 
-                     (
-                        (other.value*grad - value*other.grad) *\
-                        (other.value*other.grad - other.value*other.grad).transpose()
-                     )
-                  ) / (bottom*bottom);
-   /**/
-
-
-   return result;
-
-}
-
-
-//----------------------------------------------------------------------
-// left var is AD, right var is Number
-
-
-AD AD::operator+(Number other) {
-
-   Number new_value = value + other;
-   //std::cout << " adding " << value << " to " << other.value << std::endl;
-   int space_size = space_dim;
-
-   AD result(new_value, space_size);
-   result.grad = grad;
-   result.hess = hess;
-   return result;
-
-}
-
-AD AD::operator-(Number other) {
-
-   Number new_value = value - other;
-   int space_size = space_dim;
-   AD result(new_value, space_size);
-   result.grad = grad;
-   result.hess = hess;
-   return result;
-}
-
-AD AD::operator*(Number other) {
-
-   Number new_value = value * other;
-   int space_size = space_dim;
-
-   AD result(new_value, space_size);
-
-   result.grad = grad*other;
-
-   result.hess =  other*hess;
-
-   return result;
-
-}
-
-AD AD::operator/(Number other) {
-
-   Number new_value = value / other;
-   int space_size = space_dim;
-
-   AD result(new_value, space_size);
-
-   // save:
-   Number bottom = other*other;
-
-   // compute the gradient 
-   result.grad = ( other * grad ) / bottom;
-
-   // compute the Hessian 
-   result.hess =  (  bottom * other * hess ) / (bottom*bottom);
-
-   return result;
-
-}
-
-
-
-//-------------------------
-// printing
-void AD::print()
-{
-   std::cout << "AD(" << name << std::endl;
-   print_size();
-   print_value();
-   print_grad();
-   print_hess();
-   std::cout << "    )\n\n" << std::endl;
-}
-
-void AD::print_value()
-{
-  std::cout << " value: " << value << "" << std::endl;
-}
-void AD::print_grad()
-{
-  std::cout << " grad: \n" << grad << "" << std::endl;
-}
-void AD::print_hess()
-{
-  std::cout << " hess: \n" << hess << "" << std::endl;
-}
-
-void AD::print_size()
-{
-  std::cout << " design space size: (" << space_dim << ")" << std::endl;
-}
-
-
-
-
-
-
-
-//-------------------------
-// r-operations
-AD operator+( Number self , AD& other) {
-   return other + self;
-}
-AD operator-( Number self , AD& other) {
-   return -other + self;
-}
-AD operator*( Number self , AD& other) {
-   return other * self;
-}
-AD operator/( Number self , AD& other) {
-   int sizeofOthergrad = other.grad.size();
-   AD One(1.0f, sizeofOthergrad, 0, "one");
-   return self * One / other;//fix to handle float/AD
-}
-
-
+#include "../include/AutomaticDifferentiation.h"
+#include "../include/ADHybrid.h"
+#include "../include/ADTaylor.h"
+#include "../include/ADHvp.h"
+#include "../include/ADChunk.h"
+#include "../include/ADPattern.h"
+#include "../include/ADReverse.h"
+#include "../include/ADEigen.h"
+#include "../include/ADAssembly.h"
 
 
 
 int main() {
    std::cout  << "Eigen version: " << EIGEN_MAJOR_VERSION  << "."<< EIGEN_MINOR_VERSION  << std::endl;
-   AD a(2.0f, 2, 0, "a");
-   AD b(3.0f, 2, 1, "b");
+   // fixed size design space: no heap traffic in the operators
+   AD<2> a(2.0f, 2, 0, "a");
+   AD<2> b(3.0f, 2, 1, "b");
    a.print();
    b.print();
 
@@ -360,22 +27,22 @@ int main() {
    //      Array2D<float> res = Array2D<float>(3,1);  // Residual = f_{j+1/2) - f_{j-1/2)
    //  };
 
-   AD c = a + b;
+   AD<2> c = a + b;
    c.print();
 
-   AD d = a - b;
+   AD<2> d = a - b;
    d.print();
 
-   AD e = a * b;
+   AD<2> e = a * b;
    e.print();
 
-   AD f = a/b;
+   AD<2> f = a/b;
    f.print();
 
-   AD s1 = a+1.0f;
-   AD s2 = a-1.0f;
-   AD s3 = a*1.0f;
-   AD s4 = a/1.0f;
+   AD<2> s1 = a+1.0f;
+   AD<2> s2 = a-1.0f;
+   AD<2> s3 = a*1.0f;
+   AD<2> s4 = a/1.0f;
    s1.print();
    s2.print();
    s3.print();
@@ -385,19 +52,19 @@ int main() {
    std::cout << "a = " << std::endl;
    a.print();
 
-   AD r1 = 1.0f+a;
-   AD r2 = 1.0f-a;
+   AD<2> r1 = 1.0f+a;
+   AD<2> r2 = 1.0f-a;
    r1.print();
    r2.print();
 
-   AD r11 = 1.0+a;
-   AD r21 = 1.0-a;
+   AD<2> r11 = 1.0+a;
+   AD<2> r21 = 1.0-a;
    r11.print();
    r21.print();
 
 
-   AD r3 = a+1.0f;
-   AD r4 = a-1.0f;
+   AD<2> r3 = a+1.0f;
+   AD<2> r4 = a-1.0f;
    r3.print();
    r4.print();
 
@@ -405,13 +72,140 @@ int main() {
    std::cout << "-------------------------" << std::endl;
    std::cout << "a = " << std::endl;
    a.print();
-   AD r5 = 1.0/a;
-   AD r6 = 1.0*a;
+   AD<2> r5 = 1.0/a;
+   AD<2> r6 = 1.0*a;
    std::cout << "r5 = " << std::endl;
    r5.print();
    std::cout << "r6 = " << std::endl;
    r6.print();
 
+   std::cout << "-------------------------" << std::endl;
+   std::cout << "run time sized design space: " << std::endl;
+   AD<> x(2.0f, 3, 0, "x");
+   AD<> y(3.0f, 3, 1, "y");
+   AD<> z(4.0f, 3, 2, "z");
+   AD<> q = x*y/z;
+   q.print();
+
+   // the same evaluation with all derivative storage in a bump arena
+   ADArena arena;
+   {
+      ADArenaScope scope(arena);
+      AD<> qa = x*y/z;
+      std::cout << " arena bytes in use: " << arena.bytes_in_use()
+                << ", hess(2,2) = " << qa.hess(2,2) << std::endl;
+   }
+
+   std::cout << "-------------------------" << std::endl;
+   std::cout << "first order only (no Hessian storage or work): " << std::endl;
+   ADGradient<2> ga(2.0f, 2, 0, "ga");
+   ADGradient<2> gb(3.0f, 2, 1, "gb");
+   ADGradient<2> gq = ga*gb/(ga + 1.0f);
+   gq.print();
+
+   std::cout << "-------------------------" << std::endl;
+   std::cout << "double value and gradient, float Hessian: " << std::endl;
+   typedef AD<2, 2, double, double, float> ADMixed;
+   ADMixed ma(2.0, 2, 0, "ma");
+   ADMixed mb(3.0, 2, 1, "mb");
+   ADMixed mq = ma*mb/(ma + 1.0);
+   mq.print();
+
+   std::cout << "-------------------------" << std::endl;
+   std::cout << "elementary functions, f = exp(a)*sin(b) + pow(a, 3): " << std::endl;
+   AD<2> ea(0.5f, 2, 0, "ea");
+   AD<2> eb(1.2f, 2, 1, "eb");
+   AD<2> ef = exp(ea)*sin(eb) + pow(ea, 3);
+   ef.print();
+
+   std::cout << "-------------------------" << std::endl;
+   std::cout << "third derivatives of exp(x)*sin(y) by Taylor interpolation: " << std::endl;
+   Eigen::MatrixXf S = taylor_directions(2, 3);
+   ADTaylor<3, 4> tx(0.5f, S.row(0).transpose().array(), "tx");
+   ADTaylor<3, 4> ty(1.2f, S.row(1).transpose().array(), "ty");
+   ADTaylor<3, 4> tf = exp(tx)*sin(ty);
+   std::cout << " d3f/dx3, d3f/dx2dy, d3f/dxdy2, d3f/dy3: "
+             << taylor_tensor(tf, 2, 3).transpose() << std::endl;
+
+   std::cout << "-------------------------" << std::endl;
+   std::cout << "Hessian-vector product of exp(a)*sin(b) + pow(a, 3), v = (1, -1): " << std::endl;
+   Eigen::Vector2f v(1.0f, -1.0f);
+   ADHvp<2> va(0.5f, 2, 0, v, "va");
+   ADHvp<2> vb(1.2f, 2, 1, v, "vb");
+   ADHvp<2> vf = exp(va)*sin(vb) + pow(va, 3);
+   std::cout << " H v = " << vf.hv.transpose()
+             << "  (full Hessian: " << (ef.hess.dense()*v).transpose() << ")" << std::endl;
+
+   std::cout << "-------------------------" << std::endl;
+   std::cout << "the same Hessian by forward over reverse on a tape: " << std::endl;
+   Eigen::Vector2f ex(0.5f, 1.2f);
+   auto exp_sin = [](const auto& x) { return exp(x[0])*sin(x[1]) + pow(x[0], 3); };
+   std::cout << reverse_hessian(exp_sin, Eigen::VectorXf(ex))
+             << "\n (AD: \n" << ef.hess.dense() << ")" << std::endl;
+
+   std::cout << "-------------------------" << std::endl;
+   std::cout << "Eigen::Matrix<AD<2>>: x = A(a, b)^-1 (1, 1), A = [a 2; 0.5 b] at a = 1, b = 3: " << std::endl;
+   Eigen::Matrix<AD<2>, 2, 2> LA;
+   LA << AD<2>(1.0f, 2, 0), AD<2>(2.0f), AD<2>(0.5f), AD<2>(3.0f, 2, 1);
+   Eigen::Matrix<AD<2>, 2, 1> Lb(AD<2>(1.0f), AD<2>(1.0f));
+   Eigen::Matrix<AD<2>, 2, 1> Lx = LA.lu().solve(Lb);
+   Lx(0).print();
+
+   std::cout << "-------------------------" << std::endl;
+   std::cout << "gradient of sum x_i*x_(i+1), 2 seed directions per pass: " << std::endl;
+   Eigen::VectorXf cx = Eigen::VectorXf::LinSpaced(5, 1.0f, 5.0f);
+   auto chain = [](const auto& x) {
+      typename std::decay<decltype(x)>::type::value_type s = x[0]*x[1];
+      for (std::size_t i = 1; i + 1 < x.size(); ++i) s += x[i]*x[i+1];
+      return s;
+   };
+   std::cout << " " << chunked_gradient<2>(chain, cx).transpose() << std::endl;
+
+   std::cout << "-------------------------" << std::endl;
+   std::cout << "the same gradient by one reverse sweep: " << std::endl;
+   std::cout << " " << reverse_gradient(chain, cx).transpose() << std::endl;
+
+   std::cout << "-------------------------" << std::endl;
+   std::cout << "Hessian sparsity of sum x_i*x_(i+1) + exp(x_0): " << std::endl;
+   auto chain_exp = [](const auto& x) {
+      typename std::decay<decltype(x)>::type::value_type s = exp(x[0]);
+      for (std::size_t i = 0; i + 1 < x.size(); ++i) s += x[i]*x[i+1];
+      return s;
+   };
+   ADSparsity pattern = hessian_sparsity(chain_exp, cx);
+   std::cout << " nonzeros: " << pattern.nonZeros() << "\n" << pattern.dense() << std::endl;
+
+   std::cout << "-------------------------" << std::endl;
+   std::cout << "the same function as elements (x_i, x_(i+1)), Hessian assembled from AD<2>: " << std::endl;
+   ADElements links;
+   links.unknowns = int(cx.size());
+   links.size = 2;
+   for (int i = 0; i + 1 < links.unknowns; ++i) links.nodes.insert(links.nodes.end(), {i, i + 1});
+   auto link = [](int e, const auto& u) {
+      typename std::decay<decltype(u[0])>::type s = u[0]*u[1];
+      if (e == 0) s += exp(u[0]);
+      return s;
+   };
+   ADAssembled<Number> assembled = assemble_hessian<2>(link, cx, links);
+   std::cout << " value: " << assembled.value << "  gradient: " << assembled.vector.transpose()
+             << "\n" << Eigen::MatrixXf(assembled.matrix) << std::endl;
+
+   std::cout << "-------------------------" << std::endl;
+   std::cout << "operation counts of exp(a)*sin(b) + pow(a, 3) (make STATS=1): " << std::endl;
+   ad_stats::reset();
+   AD<> sa(0.5f, 2, 0, "sa");
+   AD<> sb(1.2f, 2, 1, "sb");
+   AD<> sf = exp(sa)*sin(sb) + pow(sa, 3);
+   ad_stats::snapshot().print();
+
+   std::cout << "-------------------------" << std::endl;
+   std::cout << "hybrid sparse/dense storage: " << std::endl;
+   ADHybrid<> h0(2.0f, 100, 0, "h0");
+   ADHybrid<> h1(3.0f, 100, 1, "h1");
+   ADHybrid<> h2 = h0*h1/(h0 + 1.0f);
+   std::cout << " grad nonzeros: " << h2.grad.nonZeros()
+             << ", hess nonzeros: " << h2.hess.nonZeros() << std::endl;
+
    //just testing Eigen a bit
    // std::cout << r2.grad << std::endl;
    // r2.grad(0,0) = 1.;
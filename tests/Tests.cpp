@@ -1,3 +1,598 @@
-
 // C++11 lest unit testing framework
-#include "../include/lest.hpp"
\ No newline at end of file
+#include "../include/lest.hpp"
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "../include/AutomaticDifferentiation.h"
+#include "../include/ADBatch.h"
+#include "../include/ADHybrid.h"
+#include "../include/ADTaylor.h"
+#include "../include/ADHvp.h"
+#include "../include/ADChunk.h"
+#include "../include/ADPattern.h"
+#include "../include/ADReverse.h"
+#include "../include/ADEigen.h"
+#include "../include/ADLinearSolve.h"
+#include "../include/ADAssembly.h"
+
+// usage> make test  (or ./run/Tests -p to list the passing cases)
+
+
+typedef Eigen::VectorXd Vector;
+typedef Eigen::MatrixXd Matrix;
+
+// |a - b| <= tol (1 + |b|) in the Frobenius norm
+template <typename A, typename B>
+bool close(const A& a, const B& b, double tol = 1.e-9) {
+   return (a - b).norm() <= tol*(1.0 + b.norm());
+}
+
+// n inputs of any AD flavour seeded at x
+template <typename T>
+std::vector<T> seed(const Vector& x) {
+   std::vector<T> vars;
+   for (int i = 0; i < x.size(); ++i) vars.emplace_back(x(i), int(x.size()), i);
+   return vars;
+}
+
+// the scalar test functions, written once for every type
+//
+// a dense Hessian with transcendental terms and a quotient
+auto dense_function = [](const auto& x) {
+   typename std::decay<decltype(x)>::type::value_type s = exp(x[0])*sin(x[1])/(x[0]*x[2] + 1.0);
+   s += pow(x[2], 3) - x[1]*x[2];
+   return s;
+};
+
+// a banded Hessian (coupling i, i+1, i+2) plus one corner entry
+auto banded_function = [](const auto& x) {
+   const std::size_t n = x.size();
+   typename std::decay<decltype(x)>::type::value_type s = sin(x[0])*x[n - 1];
+   for (std::size_t i = 0; i + 2 < n; ++i) s += x[i]*x[i]*x[i + 1]/(1.0 + x[i + 2]*x[i + 2]);
+   return s;
+};
+
+// the functions of two arguments
+auto binary_function = [](const auto& x) {
+   typename std::decay<decltype(x)>::type::value_type s = pow(x[0], x[1])*atan2(x[1], x[2]);
+   s += hypot(x[2], x[0]*x[1]);
+   return s;
+};
+
+// the same, banded
+auto banded_binary_function = [](const auto& x) {
+   typename std::decay<decltype(x)>::type::value_type s = hypot(x[0], x[1]);
+   for (std::size_t i = 0; i + 2 < x.size(); ++i) s += pow(x[i], x[i + 1])*atan2(x[i + 2], x[i]);
+   return s;
+};
+
+// compound assignment, in place functions on rvalues and aliasing
+// (also through the rvalue operators)
+auto compound_function = [](const auto& x) {
+   typedef typename std::decay<decltype(x)>::type::value_type T;
+   T s = exp(T(x[0]*x[1]));
+   s *= sqrt(x[2]);
+   s /= x[0] + 1.0;
+   s -= tanh(s)*x[1];
+   s += pow(x[2], x[0]);
+
+   // a dying right operand that the left one refers to
+   T y = x[0]*x[1];
+   s += (y*2.0) - std::move(y);
+   T z = x[1] + x[2];
+   s *= (z*2.0)/std::move(z);
+   return s;
+};
+
+// a sparse vector function: r_i = x_i^2 - x_(i+1) exp(x_(i-1)/4)
+auto residual_function = [](const auto& x) {
+   typedef typename std::decay<decltype(x)>::type::value_type T;
+   const std::size_t n = x.size();
+   std::vector<T> r;
+   for (std::size_t i = 0; i < n; ++i) {
+      T t = x[i]*x[i];
+      if (i + 1 < n) t -= x[i + 1]*exp(x[i > 0 ? i - 1 : 0]*0.25);
+      r.push_back(t);
+   }
+   return r;
+};
+
+// central difference gradient and Hessian of f on plain doubles
+template <typename F>
+Vector fd_gradient(F f, const Vector& x, double h = 1.e-6) {
+   Vector g(x.size());
+   for (int i = 0; i < x.size(); ++i) {
+      std::vector<double> p(x.data(), x.data() + x.size()), m = p;
+      p[i] += h;
+      m[i] -= h;
+      g(i) = (f(p) - f(m))/(2*h);
+   }
+   return g;
+}
+
+template <typename F>
+Matrix fd_hessian(F f, const Vector& x, double h = 1.e-4) {
+   const int n = int(x.size());
+   Matrix H(n, n);
+   for (int i = 0; i < n; ++i) {
+      for (int j = 0; j < n; ++j) {
+         std::vector<double> pp(x.data(), x.data() + n), pm = pp, mp = pp, mm = pp;
+         pp[i] += h; pp[j] += h;
+         pm[i] += h; pm[j] -= h;
+         mp[i] -= h; mp[j] += h;
+         mm[i] -= h; mm[j] -= h;
+         H(i, j) = (f(pp) - f(pm) - f(mp) + f(mm))/(4*h*h);
+      }
+   }
+   return H;
+}
+
+// f at x for one AD type
+template <typename T, typename F>
+T evaluate(F f, const Vector& x) {
+   return T(f(seed<T>(x)));
+}
+
+// value, gradient and dense Hessian by forward mode AD<>
+template <typename F>
+AD<Dynamic, 2, double> forward(F f, const Vector& x) {
+   return AD<Dynamic, 2, double>(f(seed< AD<Dynamic, 2, double> >(x)));
+}
+
+
+const lest::test specification[] = {
+
+   CASE("quotient Hessian is symmetric and matches the analytic one") {
+      typedef AD<2, 2, double> T;
+      const T a(2.0, 2, 0), b(3.0, 2, 1);
+      const T q = a/b;
+      EXPECT(q.value == lest::approx(2.0/3.0));
+      EXPECT(q.hess(0, 0) == lest::approx(0.0));
+      EXPECT(q.hess(0, 1) == lest::approx(-1.0/9.0));
+      EXPECT(q.hess(1, 0) == lest::approx(-1.0/9.0));
+      EXPECT(q.hess(1, 1) == lest::approx(2.0*2.0/27.0));
+
+      const Vector x = (Vector(3) << 0.3, 0.7, 1.1).finished();
+      const AD<Dynamic, 2, double> f = forward(dense_function, x);
+      EXPECT(close(f.grad, fd_gradient(dense_function, x), 1.e-8));
+      EXPECT(close(f.hess.dense(), fd_hessian(dense_function, x), 1.e-6));
+   },
+
+   CASE("every derivative order gives the same value and gradient") {
+      const Vector x = (Vector(3) << 1.3, 0.7, 0.4).finished();
+      auto check = [&](auto f) {
+         const AD<3, 2, double> second = evaluate< AD<3, 2, double> >(f, x);
+         const ADGradient<3, double> first = evaluate< ADGradient<3, double> >(f, x);
+         const ADValue<3, double> zeroth = evaluate< ADValue<3, double> >(f, x);
+         const ADGradient<Dynamic, double> dynamic = evaluate< ADGradient<Dynamic, double> >(f, x);
+         EXPECT(first.value == lest::approx(second.value));
+         EXPECT(zeroth.value == lest::approx(second.value));
+         EXPECT(dynamic.value == lest::approx(second.value));
+         EXPECT(close(first.grad, second.grad));
+         EXPECT(close(dynamic.grad, second.grad));
+         EXPECT(close(second.grad, fd_gradient(f, x), 1.e-8));
+      };
+      check(dense_function);
+      check(binary_function);
+      check(compound_function);
+   },
+
+   CASE("Order 1 carries no Hessian and does no Hessian work") {
+      static_assert(std::is_same<ADGradient<3>::Hessian, NoDerivative>::value, "no Hessian storage");
+      static_assert(std::is_same<ADGradient<>::Hessian, NoDerivative>::value, "no Hessian storage");
+      static_assert(std::is_same<ADValue<3>::Gradient, NoDerivative>::value, "no gradient storage");
+      static_assert(sizeof(ADGradient<8>) < sizeof(AD<8>), "Order 1 is smaller than Order 2");
+
+      // with make STATS=1: no rank updates at Order 1, some at Order 2
+      const Vector x = (Vector(3) << 1.3, 0.7, 0.4).finished();
+      ad_stats::reset();
+      evaluate< ADGradient<Dynamic, double> >(compound_function, x);
+      EXPECT(ad_stats::snapshot().hessian_updates == 0u);
+      evaluate< AD<Dynamic, 2, double> >(compound_function, x);
+      EXPECT((ad_stats::snapshot().hessian_updates > 0u) == ad_stats::enabled);
+   },
+
+   CASE("moving an arena vector into a heap vector copies the values") {
+      typedef ArenaVector<double> V;
+      V heap(3);
+      heap.setConstant(1.0);
+      const double* buffer = heap.data();
+
+      ADArena arena;
+      {
+         ADArenaScope scope(arena);
+         V scratch(3);
+         scratch.setConstant(2.0);
+         heap = std::move(scratch);
+         EXPECT(heap.data() == buffer);
+
+         // within one arena the buffers are swapped
+         V other(3);
+         other.setConstant(3.0);
+         const double* moved = other.data();
+         scratch = std::move(other);
+         EXPECT(scratch.data() == moved);
+      }
+      EXPECT(heap.data() == buffer);
+      EXPECT(close(heap, Eigen::Vector3d(2.0, 2.0, 2.0)));
+
+      V empty;
+      {
+         ADArenaScope scope(arena);
+         V scratch(4);
+         scratch.setConstant(4.0);
+         empty = std::move(scratch);
+      }
+      EXPECT(close(empty, Eigen::Vector4d(4.0, 4.0, 4.0, 4.0)));
+
+      // two heap vectors swap their buffers
+      V other(4);
+      other.setConstant(5.0);
+      const double* moved = other.data();
+      heap = std::move(other);
+      EXPECT(heap.data() == moved);
+      EXPECT(close(heap, Eigen::Vector4d(5.0, 5.0, 5.0, 5.0)));
+   },
+
+   CASE("copying an arena AD<> into an outer one keeps the outer storage") {
+      typedef AD<Dynamic, 2, double> T;
+      const Vector x = (Vector(3) << 1.3, 0.7, 0.4).finished();
+      const T reference = forward(dense_function, x);
+
+      T best, sized(0.0, 3);
+      ADArena arena;
+      {
+         ADArenaScope scope(arena);
+         const T f = dense_function(seed<T>(x));
+         best = f;
+         sized = f;
+      }
+      {
+         // overwrite the released arena memory
+         ADArenaScope scope(arena);
+         std::vector<T> overwrite;
+         for (int k = 0; k < 4; ++k) overwrite.push_back(dense_function(seed<T>(Vector::Constant(3, 9.0))));
+      }
+      for (const T* t : {&best, &sized}) {
+         EXPECT(t->value == lest::approx(reference.value));
+         EXPECT(close(t->grad, reference.grad));
+         EXPECT(close(t->hess.dense(), reference.hess.dense()));
+      }
+   },
+
+   CASE("Taylor mode third derivatives match the analytic tensor") {
+      typedef ADTaylor<3, 4, double> T;
+      const Matrix S = taylor_directions<double>(2, 3);
+      const double x = 0.5, y = 1.2;
+      const T tx(x, S.row(0).transpose().array());
+      const T ty(y, S.row(1).transpose().array());
+      const T tf = exp(tx)*sin(ty);
+
+      // d3f/dx3, d3f/dx2dy, d3f/dxdy2, d3f/dy3 of exp(x) sin(y)
+      const Vector expected = (Vector(4) << std::exp(x)*std::sin(y), std::exp(x)*std::cos(y),
+                                            -std::exp(x)*std::sin(y), -std::exp(x)*std::cos(y)).finished();
+      EXPECT(close(taylor_tensor(tf, 2, 3), expected, 1.e-10));
+   },
+
+   CASE("Taylor pow is exact at a zero base and mixes with any arithmetic type") {
+      // x(t) = t along one direction: x^3 = t^3, so c_3 = 1 and the rest 0
+      typedef ADTaylor<4, 1> T;
+      const T x(0.0f, T::Lanes::Constant(1.0f));
+      const T cube = pow(x, 3);
+      const T cube_real = pow(x, 3.0);
+      for (int k = 0; k <= 4; ++k) {
+         EXPECT(cube.coeff(0, k) == lest::approx(k == 3 ? 1.0 : 0.0));
+         EXPECT(cube_real.coeff(0, k) == lest::approx(k == 3 ? 1.0 : 0.0));
+      }
+
+      // float ADTaylor with int and double operands on either side
+      const T y(0.5f, T::Lanes::Constant(1.0f));
+      const T mixed = 2*y + (1.0 - y)/3 - pow(y, 2)*0.5;
+      const T same = y*2.0f + (1.0f - y)/3.0f - y*y*0.5f;
+      EXPECT(close(mixed.coeff.matrix(), same.coeff.matrix(), 1.e-6));
+
+      // negative and non-integer exponents against exp(r log y)
+      typedef ADTaylor<4, 2, double> TD;
+      const TD z(0.7, TD::Lanes(1.0, -0.5));
+      EXPECT(close(pow(z, -2).coeff.matrix(), exp(-2.0*log(z)).coeff.matrix()));
+      EXPECT(close(pow(z, 2.5).coeff.matrix(), exp(2.5*log(z)).coeff.matrix()));
+   },
+
+   CASE("H V by ADHvp matches the full Hessian") {
+      const Vector x = (Vector(3) << 0.3, 0.7, 1.1).finished();
+      Eigen::Matrix<double, 3, 2> V;
+      V << 1.0, 0.5, -1.0, 0.0, 2.0, -0.25;
+
+      std::vector< ADHvp<3, 2, double> > vars;
+      for (int i = 0; i < 3; ++i) vars.emplace_back(x(i), 3, i, V);
+      const ADHvp<3, 2, double> f = dense_function(vars);
+
+      const AD<Dynamic, 2, double> reference = forward(dense_function, x);
+      EXPECT(f.value == lest::approx(reference.value));
+      EXPECT(close(f.grad, reference.grad));
+      EXPECT(close(f.hv, reference.hess.dense()*V));
+   },
+
+   CASE("H V of the functions of two arguments matches the full Hessian") {
+      const Vector x = (Vector(3) << 1.3, 0.7, -0.4).finished();
+      const Eigen::Matrix<double, 3, 1> v(0.5, -1.0, 2.0);
+
+      std::vector< ADHvp<Dynamic, 1, double> > vars;
+      for (int i = 0; i < 3; ++i) vars.emplace_back(x(i), 3, i, v);
+      const ADHvp<Dynamic, 1, double> f = binary_function(vars);
+
+      const AD<Dynamic, 2, double> reference = forward(binary_function, x);
+      EXPECT(close(reference.hess.dense(), fd_hessian(binary_function, x), 1.e-6));
+      EXPECT(f.value == lest::approx(reference.value));
+      EXPECT(close(f.grad, reference.grad));
+      EXPECT(close(f.hv, reference.hess.dense()*v));
+
+      // inputs with implicit unit gradients give the same products
+      const Vector y = x.cwiseAbs();
+      auto check = [&](auto g) {
+         typedef ADHvp<Dynamic, 1, double> T;
+         std::vector<T> inputs;
+         for (int i = 0; i < 3; ++i) inputs.push_back(T::input(y(i), 3, i, v.row(i)));
+         const T h = g(inputs);
+         const AD<Dynamic, 2, double> expected = forward(g, y);
+         EXPECT(h.value == lest::approx(expected.value));
+         EXPECT(close(h.grad, expected.grad));
+         EXPECT(close(h.hv, expected.hess.dense()*v));
+      };
+      check(binary_function);
+      check(compound_function);
+   },
+
+   CASE("ADHybrid matches AD with functions, compound operators and sparse storage") {
+      const Vector x = (Vector(3) << 1.3, 0.7, -0.4).finished();
+      auto check = [&](auto f) {
+         const ADHybrid<double> h = f(seed< ADHybrid<double> >(x));
+         const AD<Dynamic, 2, double> reference = forward(f, x);
+         EXPECT(h.value == lest::approx(reference.value));
+         EXPECT(close(h.gradient(), reference.grad));
+         EXPECT(close(h.hessian(), reference.hess.dense()));
+
+         const ADHybrid<> single = f(seed< ADHybrid<> >(x));
+         EXPECT(close(single.hessian().cast<double>(), reference.hess.dense(), 1.e-5));
+      };
+      check(dense_function);
+      check(binary_function);
+
+      // a banded Hessian stays index-compressed
+      const Vector y = Vector::LinSpaced(64, 0.2, 1.7);
+      const ADHybrid<double> b = banded_function(seed< ADHybrid<double> >(y));
+      EXPECT(b.hess.sparse);
+      EXPECT(close(b.hessian(), forward(banded_function, y).hess.dense()));
+
+      std::vector< ADHybrid<> > vars = seed< ADHybrid<> >(x);
+      ADHybrid<> c = vars[0];
+      c *= vars[1];
+      c += 2.0f;
+      c /= vars[2];
+      c -= vars[1];
+      c *= 0.5f;
+      const ADHybrid<> d = (vars[0]*vars[1] + 2.0f)/vars[2]*0.5f - 0.5f*vars[1];
+      EXPECT(c.value == lest::approx(d.value));
+      EXPECT(close(c.hessian(), d.hessian(), 1.e-6));
+   },
+
+   CASE("every ADBatch lane matches AD at its own point") {
+      typedef ADBatch<4, 3, double> B;
+      auto f = [](const auto& v) { return (v[0]*v[1] + 2.0)/v[2] - 0.5*v[1]*v[1] + 1.0/v[0]; };
+      std::vector<B> vars;
+      for (int i = 0; i < 3; ++i) vars.emplace_back(B::Lanes::LinSpaced(0.5 + i, 1.5 + i), 3, i);
+      const B batch = f(vars);
+      for (int w = 0; w < 4; ++w) {
+         const Vector x = (Vector(3) << vars[0].value(w), vars[1].value(w), vars[2].value(w)).finished();
+         const AD<Dynamic, 2, double> reference = forward(f, x);
+         const AD<3, 2, double> lane = batch.lane(w);
+         EXPECT(lane.value == lest::approx(reference.value));
+         EXPECT(close(lane.grad, reference.grad));
+         EXPECT(close(lane.hess.dense(), reference.hess.dense()));
+      }
+   },
+
+   CASE("sparse_jacobian matches the dense Jacobian") {
+      const Vector x = Vector::LinSpaced(12, 0.5, 1.6);
+      const Eigen::SparseMatrix<double, Eigen::RowMajor> J = sparse_jacobian(residual_function, x);
+      const Matrix dense = chunked_jacobian<4>(residual_function, x);
+      EXPECT(J.nonZeros() < dense.size());
+      EXPECT(close(Matrix(J), dense));
+   },
+
+   CASE("sparsity patterns take any Eigen vector and scalar compound operators") {
+      auto shifted = [](const auto& x) {
+         typedef typename std::decay<decltype(x)>::type::value_type T;
+         std::vector<T> r;
+         T a = x[0];
+         a += 1.0;
+         a -= 2.0f;
+         a *= x[1];
+         a /= 3;
+         T b = x[2];
+         b -= 0.5;
+         r.push_back(a);
+         r.push_back(b*b);
+         return r;
+      };
+      const Eigen::Vector3d x(0.5, 1.5, 2.5);
+      const ADSparsity J = jacobian_sparsity(shifted, x);
+      EXPECT(J.nonZeros() == 3);
+      EXPECT(J.dense() == jacobian_sparsity(shifted, x.cast<float>()).dense());
+      EXPECT(close(Matrix(sparse_jacobian(shifted, Vector(x))), chunked_jacobian<3>(shifted, Vector(x))));
+
+      // c x_0 x_1 (x_2 - 1/2)^2: all pairs but (0, 0) and (1, 1)
+      auto scalar = [&](const auto& x) { return shifted(x)[0]*shifted(x)[1]; };
+      EXPECT(hessian_sparsity(scalar, x).nonZeros() == 7);
+      EXPECT(hessian_sparsity(scalar, Eigen::Vector4d(0.5, 1.5, 2.5, 3.5).head<3>()).nonZeros() == 7);
+   },
+
+   CASE("Hessian patterns of long reductions match the dense Hessian pattern") {
+      // banded over inputs far apart in the bitsets, reduced in place
+      const Vector x = Vector::LinSpaced(300, 0.2, 1.7);
+      const ADSparsity pattern = hessian_sparsity(banded_function, x);
+      const Matrix dense = forward(banded_function, x).hess.dense();
+      EXPECT(pattern.dense() == (dense.array() != 0.0).cast<int>().matrix());
+
+      // the pairs are recorded only inside a scope, by every operation
+      typedef ADPattern<2, double> T;
+      std::vector<T> vars = pattern_inputs<2>(x.head(3));
+      T s = vars[0]*vars[1];
+      ADPairSet pairs;
+      {
+         ADPairSetScope scope(pairs);
+         T t = (vars[1] + 1.0)*vars[2];
+         t *= 2.0;
+         EXPECT(hessian_pattern(pairs, 3).nonZeros() == 2);
+      }
+      EXPECT(pairs.size() == 0u);
+      EXPECT(s.grad.indices() == std::vector<int>({0, 1}));
+   },
+
+   CASE("star coloring recovers the dense Hessian") {
+      const Vector x = Vector::LinSpaced(16, 0.2, 1.7);
+      const Matrix dense = forward(banded_function, x).hess.dense();
+
+      const ADSparsity pattern = hessian_sparsity(banded_function, x);
+      const ADColoring coloring = star_coloring(pattern);
+      EXPECT(coloring.colors < int(x.size()));
+
+      // compressed H S from the dense Hessian
+      Matrix S = Matrix::Zero(x.size(), coloring.colors);
+      for (int i = 0; i < x.size(); ++i) S(i, coloring.color[i]) = 1.0;
+      EXPECT(close(Matrix(star_recovery(pattern, coloring, Matrix(dense*S))), dense));
+
+      EXPECT(close(Matrix(sparse_hessian(banded_function, x)), dense));
+      EXPECT(close(Matrix(sparse_hessian<2>(banded_function, x)), dense));
+   },
+
+   CASE("reverse gradients and Hessians match forward mode") {
+      const Vector x = (Vector(3) << 0.3, 0.7, 1.1).finished();
+      const AD<Dynamic, 2, double> reference = forward(dense_function, x);
+      EXPECT(close(reverse_gradient(dense_function, x), reference.grad));
+      EXPECT(close(reverse_hessian(dense_function, x), reference.hess.dense()));
+      EXPECT(close(reverse_hessian(dense_function, x, 2), reference.hess.dense()));
+
+      const Matrix V = Matrix::Identity(3, 3).leftCols(2);
+      EXPECT(close(reverse_hessian_product(dense_function, x, V), reference.hess.dense()*V));
+
+      const Vector y = Vector::LinSpaced(16, 0.2, 1.7);
+      EXPECT(close(Matrix(reverse_sparse_hessian(banded_function, y)),
+                   forward(banded_function, y).hess.dense()));
+   },
+
+   CASE("the tape differentiates the functions of two arguments") {
+      const Vector x = (Vector(3) << 1.3, 0.7, -0.4).finished();
+      const AD<Dynamic, 2, double> reference = forward(binary_function, x);
+      EXPECT(close(reverse_gradient(binary_function, x), reference.grad));
+      EXPECT(close(reverse_hessian(binary_function, x), reference.hess.dense()));
+   },
+
+   CASE("reverse_sparse_hessian matches sparse_hessian with functions of two arguments") {
+      const Vector x = Vector::LinSpaced(16, 0.4, 1.9);
+      const Matrix forward_colored = Matrix(sparse_hessian(banded_binary_function, x));
+      EXPECT(close(forward_colored, forward(banded_binary_function, x).hess.dense()));
+      EXPECT(close(Matrix(reverse_sparse_hessian(banded_binary_function, x)), forward_colored));
+
+      // compound operators with plain numbers work through every driver
+      auto scaled = [](const auto& u) {
+         typename std::decay<decltype(u)>::type::value_type s = banded_binary_function(u);
+         s += 1.0;
+         s *= 3.0;
+         s -= 0.5;
+         s /= 2.0;
+         return s;
+      };
+      EXPECT(close(Matrix(sparse_hessian(scaled, x)), 1.5*forward_colored));
+      EXPECT(close(Matrix(reverse_sparse_hessian(scaled, x)), 1.5*forward_colored));
+   },
+
+   CASE("linear_solve derivatives match the AD LU solve") {
+      typedef AD<2, 2, double> T;
+      const T a(1.0, 2, 0), b(3.0, 2, 1);
+      Eigen::Matrix<T, Dynamic, Dynamic> A(3, 3);
+      A << a, T(2.0), a*b, T(0.5), b, T(1.0), sin(a), T(0.25), b*b;
+      Eigen::Matrix<T, Dynamic, 1> r(3);
+      r << T(1.0), a, exp(b*0.1);
+
+      const Eigen::Matrix<T, Dynamic, 1> x = linear_solve(A, r);
+      const Eigen::Matrix<T, Dynamic, 1> y = A.lu().solve(r);
+      for (int i = 0; i < 3; ++i) {
+         EXPECT(x(i).value == lest::approx(y(i).value));
+         EXPECT(close(x(i).grad, y(i).grad));
+         EXPECT(close(x(i).hess.dense(), y(i).hess.dense()));
+      }
+
+      // fixed size operands and expressions give the same solution
+      const Eigen::Matrix<T, 3, 3> fixed = A;
+      const Eigen::Matrix<T, 3, 1> z = linear_solve(fixed, fixed.col(2));
+      const Eigen::Matrix<T, Dynamic, 1> w = linear_solve(A.topLeftCorner(3, 3), A.col(2));
+      for (int i = 0; i < 3; ++i) {
+         EXPECT(z(i).value == lest::approx(i == 2 ? 1.0 : 0.0));
+         EXPECT(close(z(i).grad, Eigen::Vector2d::Zero()));
+         EXPECT(close(z(i).hess.dense(), w(i).hess.dense()));
+         EXPECT(close(w(i).grad, z(i).grad));
+      }
+   },
+
+   CASE("assembled Hessians match the global Hessian") {
+      // chain of elements (i, i+1) plus a degenerate element (0, 0)
+      const int n = 6;
+      ADElements elements;
+      elements.unknowns = n;
+      elements.size = 2;
+      for (int i = 0; i + 1 < n; ++i) elements.nodes.insert(elements.nodes.end(), {i, i + 1});
+      elements.nodes.insert(elements.nodes.end(), {0, 0});
+
+      auto kernel = [](int e, const auto& u) {
+         typename std::decay<decltype(u[0])>::type s = u[0]*u[0]*u[1];
+         if (e == 0) s += exp(u[0]);
+         return s;
+      };
+      auto global = [&](const auto& x) {
+         typename std::decay<decltype(x)>::type::value_type s = exp(x[0]) + x[0]*x[0]*x[0];
+         for (int i = 0; i + 1 < n; ++i) s += x[i]*x[i]*x[i + 1];
+         return s;
+      };
+
+      const Vector x = Vector::LinSpaced(n, 0.5, 1.5);
+      const ADAssembled<double> assembled = assemble_hessian<2>(kernel, x, elements);
+      const AD<Dynamic, 2, double> reference = forward(global, x);
+      EXPECT(assembled.value == lest::approx(reference.value));
+      EXPECT(close(assembled.vector, reference.grad));
+      EXPECT(close(Matrix(assembled.matrix), reference.hess.dense()));
+   },
+
+   CASE("threaded assembly matches the serial one and passes kernel errors on") {
+      // a chain long enough to split every color over 4 threads
+      const int n = 4001;
+      ADElements elements;
+      elements.unknowns = n;
+      elements.size = 2;
+      for (int i = 0; i + 1 < n; ++i) elements.nodes.insert(elements.nodes.end(), {i, i + 1});
+      const ADAssembly plan = element_assembly(elements);
+
+      auto kernel = [](int, const auto& u) { return sin(u[0])*u[1]*u[1]; };
+      const Vector x = Vector::LinSpaced(n, -1.0, 1.0);
+      ADAssembled<double> serial, threaded;
+      assemble_hessian<2>(kernel, x, elements, plan, serial, 1);
+      assemble_hessian<2>(kernel, x, elements, plan, threaded, 4);
+      EXPECT(threaded.value == lest::approx(serial.value));
+      EXPECT(close(threaded.vector, serial.vector));
+      EXPECT(close(Matrix(threaded.matrix), Matrix(serial.matrix)));
+
+      auto failing = [](int e, const auto& u) {
+         if (e == 3000) throw std::runtime_error("element 3000");
+         return u[0]*u[1];
+      };
+      EXPECT_THROWS_AS(assemble_hessian<2>(failing, x, elements, plan, threaded, 4), std::runtime_error);
+   },
+
+};
+
+
+int main(int argc, char** argv) {
+   return lest::run(specification, argc, argv);
+}